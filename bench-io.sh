@@ -0,0 +1,182 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Device I/O benchmark suite, run by `make bench`:
+#
+#   ./bench-io.sh [./tdx-cfgblock-bench]
+#
+# The board devices are replaced by files in a scratch sysroot which the
+# benchmark build accesses with the latency of an I2C EEPROM at 100 kHz
+# (TDX_CFGBLOCK_FAKE_LATENCY, override it to model other parts). Every
+# scenario runs RUNS times; the fastest run is reported with the device
+# I/O counters of --stats. syscalls counts the system calls made on the
+# devices (open, pread, pwrite, close, ...). The last scenarios add EXTRA
+# carrier board EEPROMs, each on a bus of its own as on a test rack, and
+# compare the sync and the io_uring device reads of discovery and print all
+# and batch against gang-create. The checks at the end verify results of
+# past bugs and stop the run on a mismatch.
+
+set -e
+
+BIN=${1:-./tdx-cfgblock-bench}
+RUNS=${RUNS:-3}
+MODULE=${MODULE:-0058110106000001}
+CARRIER=${CARRIER:-0156110200000001}
+EXTRA=${EXTRA:-24}
+
+export TDX_CFGBLOCK_FAKE_LATENCY="${TDX_CFGBLOCK_FAKE_LATENCY:-read_us=100,page_us=5000,page=16}"
+TDX_CFGBLOCK_SYSROOT=$(mktemp -d)
+export TDX_CFGBLOCK_SYSROOT
+trap 'rm -rf "$TDX_CFGBLOCK_SYSROOT"' EXIT
+
+root=$TDX_CFGBLOCK_SYSROOT
+nvmem=$root/sys/bus/nvmem/devices
+mkdir -p "$root/dev" "$root/sys/block/mmcblk2boot0"
+mkdir -p "$root/run"
+echo 8192 > "$root/sys/block/mmcblk2boot0/size"
+
+# Erase all devices, the way they come from the factory
+blank()
+{
+	rm -f "$root/dev/mmcblk2boot0"
+	truncate -s 4M "$root/dev/mmcblk2boot0"
+	for dev in 3-00573 3-00513; do
+		mkdir -p "$nvmem/$dev"
+		head -c 256 /dev/zero | tr '\000' '\377' > "$nvmem/$dev/nvmem"
+	done
+}
+
+cat > "$root/batch.txt" <<EOB
+/dev/mmcblk2boot0 module $MODULE
+/sys/bus/nvmem/devices/3-00573/nvmem carrier $CARRIER
+/sys/bus/nvmem/devices/3-00513/nvmem carrier $CARRIER
+EOB
+
+# [prep=cmd] run <scenario> <args...>, with cmd run untimed before each run
+run()
+{
+	name=$1
+	shift
+	best=
+	for i in $(seq "$RUNS"); do
+		${prep:-:}
+		start=$(date +%s%N)
+		if ! "$BIN" --no-cache --stats "$@" > "$root/out" 2> "$root/err"; then
+			echo "scenario=$name error: $*" >&2
+			cat "$root/out" "$root/err" >&2
+			exit 1
+		fi
+		ns=$(($(date +%s%N) - start))
+		if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then
+			best=$ns
+		fi
+	done
+	grep "^io_opens=" "$root/err" | tr ' =' '\n ' | {
+		while read -r key value; do
+			eval "$key=\$value"
+		done
+		printf "scenario=%-16s wall=%d.%03dms reads=%s bytes_read=%s " \
+			"$name" $((best / 1000000)) $((best / 1000 % 1000)) \
+			"$io_reads" "$io_bytes_read"
+		printf "writes=%s bytes_written=%s syscalls=%s\n" \
+			"$io_writes" "$io_bytes_written" "$io_syscalls"
+	}
+}
+
+# check <name> <expected> <actual>, for the regression checks at the end
+check()
+{
+	if [ "$2" != "$3" ]; then
+		echo "check=$1 error: expected '$2', got '$3'" >&2
+		exit 1
+	fi
+	echo "check=$1 ok"
+}
+
+echo "latency: $TDX_CFGBLOCK_FAKE_LATENCY runs=$RUNS"
+# No nvmem devices at all yet, as on hosts without an nvmem class
+run discover-empty devices rescan
+blank
+run discover devices rescan
+prep=blank run create create -y "$MODULE"
+run create-unchanged create -y "$MODULE"
+run print print
+run print-field print module_serial
+prep=blank run carrier-create create carrier -y "$CARRIER"
+run carrier-print print carrier
+prep=blank run batch batch -y "$root/batch.txt"
+run print-all print all
+
+# More EEPROMs, one per bus, holding carrier config blocks
+blank_extra()
+{
+	for i in $(seq "$EXTRA"); do
+		head -c 256 /dev/zero | tr '\000' '\377' \
+			> "$nvmem/$((10 + i))-0057/nvmem"
+	done
+}
+
+: > "$root/gang.txt"
+for i in $(seq "$EXTRA"); do
+	dev=$((10 + i))-0057
+	mkdir -p "$nvmem/$dev"
+	echo "/sys/bus/nvmem/devices/$dev/nvmem carrier $CARRIER" \
+		>> "$root/gang.txt"
+done
+blank_extra
+"$BIN" --no-cache gang-create "$root/gang.txt" > /dev/null 2>&1
+run discover-sync --io sync devices rescan
+run discover-uring --io uring devices rescan
+run print-all-sync --io sync print all
+run print-all-uring --io uring print all
+prep=blank_extra run batch-extra batch "$root/gang.txt"
+prep=blank_extra run gang-create gang-create "$root/gang.txt"
+
+# set must keep the other fields of a product id missing from the tables
+img=$root/image.bin
+"$BIN" --image "$img" create -y "$MODULE" > /dev/null
+printf '\017\047' | dd of="$img" bs=1 seek=14 conv=notrunc 2> /dev/null
+"$BIN" --image "$img" set ver_assembly=3 > /dev/null
+check set-unknown-prodid "03 00 0f 27" "$(od -An -tx1 -j12 -N4 "$img" | xargs)"
+
+# a serial without a known OUI is refused, not stored with another MAC
+rc=0
+"$BIN" --image "$img" set serial=99000000 > /dev/null || rc=$?
+check set-serial-no-oui 2 $rc
+
+# create refuses the barcodes validate-barcodes rejects
+rc=0
+"$BIN" --image "$img" create -y 0058110199000001 > /dev/null || rc=$?
+check create-bad-barcode 1 $rc
+
+# an oversized -j is clamped rather than sizing a stack array from it
+: > "$root/empty.bin"
+rc=0
+"$BIN" scan -j 100000000 "$root/empty.bin" "$img" > /dev/null 2>&1 || rc=$?
+check scan-huge-jobs 0 $rc
+rc=0
+"$BIN" scan -j 4x "$img" > /dev/null 2>&1 || rc=$?
+check scan-bad-jobs 2 $rc
+
+# a field whose tag is missing from the block is reported, not made up
+"$BIN" --image "$img" create -y "$MODULE" > /dev/null
+printf '\000\100' | dd of="$img" bs=1 seek=18 conv=notrunc 2> /dev/null
+check field-not-present "module_serial not present" \
+	"$("$BIN" --no-cache --image "$img" print module_serial)"
+
+# a blank EEPROM programmed by batch shows up without a rescan
+mkdir -p "$nvmem/5-0050"
+head -c 256 /dev/zero | tr '\000' '\377' > "$nvmem/5-0050/nvmem"
+"$BIN" devices rescan > /dev/null
+echo "/sys/bus/nvmem/devices/5-0050/nvmem carrier $CARRIER" |
+	"$BIN" batch -y > /dev/null 2>&1
+check batch-new-device 1 "$("$BIN" devices | grep -c 5-0050/)"
+
+# aggregate refuses a truncated export, even if the grouped columns survive
+"$BIN" generate "${MODULE%????????}" 6000001 6001000 "$root/blocks.bin" \
+	2> /dev/null
+"$BIN" export --columnar -o "$root/export.col" "$root/blocks.bin" 2> /dev/null
+head -c 1000 "$root/export.col" > "$root/truncated.col"
+rc=0
+"$BIN" aggregate "$root/truncated.col" > /dev/null || rc=$?
+check aggregate-truncated 1 $rc
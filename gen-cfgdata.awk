@@ -0,0 +1,314 @@
+# SPDX-License-Identifier: GPL-2.0+
+#
+# Generate tdx-cfgdata.h from tdx-cfgdata.txt:
+#
+#   awk -f gen-cfgdata.awk tdx-cfgdata.txt > tdx-cfgdata.h
+#
+# Product ids share one 4 digit pid4 space, so any id used twice, an id out
+# of range or a reused enum name is an error here rather than a silently
+# overwritten table entry. Plain POSIX awk, run with LC_ALL=C so the search
+# tokens come out in strcmp() order.
+
+function fail(msg)
+{
+	printf("%s:%d: error: %s\n", FILENAME, FNR, msg) > "/dev/stderr"
+	failed = 1
+	exit 1
+}
+
+function check_id(id, what)
+{
+	if (id !~ /^[0-9]+$/ || id + 0 > 9999)
+		fail(what " id '" id "' is not a 4 digit number")
+	id += 0
+	if (id in pid4_used)
+		fail(what " id " id " is already used by " pid4_used[id])
+	return id
+}
+
+function check_enum(name)
+{
+	if (name !~ /^[A-Z][A-Z0-9_]*$/)
+		fail("bad enum name '" name "'")
+	if (name in enum_used)
+		fail("enum name " name " is already used")
+	enum_used[name] = 1
+}
+
+# Everything after the first n fields of the current line
+function rest(n,	s, i)
+{
+	s = $0
+	for (i = 0; i < n; i++)
+		sub(/^[ \t]*[^ \t]+[ \t]+/, "", s)
+	sub(/[ \t]+$/, "", s)
+	if (s == "" || s ~ /["\\]/)
+		fail("missing or bad product name")
+	return s
+}
+
+# Add the words of s to the search index for product p
+function add_words(s, p,	w, n, i)
+{
+	n = split(tolower(s), w, /[^a-z0-9]+/)
+	for (i = 1; i <= n; i++) {
+		if (w[i] == "" || (w[i], p) in token_has)
+			continue
+		token_has[w[i], p] = 1
+		if (!(w[i] in token_seen)) {
+			token_seen[w[i]] = 1
+			tokens[++ntokens] = w[i]
+		}
+		token_bits[w[i], int(p / 32)] += 2 ^ (p % 32)
+	}
+}
+
+function add_product(type, id,	p)
+{
+	p = nproducts++
+	products_type[p] = type
+	products_id[p] = id
+	return p
+}
+
+function sort_ids(a, n,	i, j, t)
+{
+	for (i = 2; i <= n; i++) {
+		t = a[i]
+		for (j = i - 1; j >= 1 && a[j] > t; j--)
+			a[j + 1] = a[j]
+		a[j + 1] = t
+	}
+}
+
+function sort_strings(a, n,	i, j, t)
+{
+	for (i = 2; i <= n; i++) {
+		t = a[i]
+		for (j = i - 1; j >= 1 && ("" a[j]) > ("" t); j--)
+			a[j + 1] = a[j]
+		a[j + 1] = t
+	}
+}
+
+# pid4 list table plus its dense pid4 -> table index map
+function print_pid4list(kind, table, unknown, ids, n,	i, base, idx)
+{
+	sort_ids(ids, n)
+	base = "TDX_" toupper(kind) "_PID4_BASE"
+	idx = n < 256 ? "uint8_t" : "uint16_t"
+
+	printf("const struct tdx_pid4list %s[] = {\n", table)
+	printf("\t{0,%s\"%s\"},\n", tabs("0"), unknown)
+	for (i = 1; i <= n; i++)
+		printf("\t{%s,%s\"%s\"},\n", enum_of[kind, ids[i]],
+		       tabs(enum_of[kind, ids[i]]), name_of[kind, ids[i]])
+	printf("};\n\n")
+
+	printf("#define %s\t%d\n\n", base, ids[1])
+	printf("/* %s[] index by pid4 - %s, 0 if unknown */\n", table, base)
+	printf("static const %s %s_pid4[] = {\n", idx, table)
+	for (i = 1; i <= n; i++)
+		printf("\t[%s - %s] = %d,\n", enum_of[kind, ids[i]], base, i)
+	printf("};\n\n")
+}
+
+# Tabs aligning the column after "\t{" s ","
+function tabs(s,	n, t)
+{
+	n = 4 - int((length(s) + 2) / 8)
+	t = "\t"
+	while (n-- > 1)
+		t = t "\t"
+	return t
+}
+
+/^[ \t]*(#|$)/ {
+	next
+}
+
+$1 == "module" {
+	id = check_id($2, "module")
+	check_enum($3)
+	if ($4 != "-" && $4 !~ /^[A-Z][A-Z0-9_]*$/)
+		fail("bad module family '" $4 "'")
+	pid4_used[id] = $3
+	enum_of["module", id] = $3
+	family_of[id] = $4
+	name_of["module", id] = rest(4)
+	if (id > module_max)
+		module_max = id
+	next
+}
+
+$1 == "carrier" || $1 == "display" {
+	id = check_id($2, $1)
+	check_enum($3)
+	pid4_used[id] = $3
+	enum_of[$1, id] = $3
+	name_of[$1, id] = rest(3)
+	if ($1 == "carrier")
+		carriers[++ncarriers] = id
+	else
+		displays[++ndisplays] = id
+	next
+}
+
+$1 == "oui" {
+	if ($2 !~ /^[0-9]+$/ || ($2 + 0) in ouis)
+		fail("bad or duplicate oui index '" $2 "'")
+	if (length($3) != 8 || $3 !~ /^0x[0-9a-f]+$/)
+		fail("oui '" $3 "' is not 0x followed by 6 hex digits")
+	ouis[$2 + 0] = $3
+	if ($2 + 1 > nouis)
+		nouis = $2 + 1
+	next
+}
+
+{
+	fail("unknown entry '" $1 "'")
+}
+
+END {
+	if (failed)
+		exit 1
+	if (!module_max || !ncarriers || !ndisplays || !nouis) {
+		FNR = 0
+		fail("need at least one module, carrier, display and oui")
+	}
+	for (i = 0; i < nouis; i++) {
+		if (!(i in ouis)) {
+			FNR = 0
+			fail("oui index " i " is missing")
+		}
+	}
+
+	print "/* SPDX-License-Identifier: GPL-2.0+ */"
+	print "/*"
+	print " * Copyright (c) 2016-2020 Toradex"
+	print " *"
+	print " * Generated from tdx-cfgdata.txt by gen-cfgdata.awk, do not edit."
+	print " */"
+	print ""
+	print "#ifndef _TDX_CFG_BLOCK_DATA_H"
+	print "#define _TDX_CFG_BLOCK_DATA_H"
+	print ""
+
+	print "enum {"
+	for (id = 1; id <= module_max; id++) {
+		if (("module", id) in enum_of)
+			printf("\t%s = %d,\n", enum_of["module", id], id)
+	}
+	print "};"
+	print ""
+	print "enum {"
+	for (i = 1; i <= ncarriers; i++)
+		printf("\t%s = %d,\n", enum_of["carrier", carriers[i]],
+		       carriers[i])
+	print "};"
+	print ""
+	print "enum {"
+	for (i = 1; i <= ndisplays; i++)
+		printf("\t%s = %d,\n", enum_of["display", displays[i]],
+		       displays[i])
+	print "};"
+	print ""
+
+	print "#define TDX_PID4_MAX\t\t9999"
+	printf("#define TDX_MODULES_COUNT\t%d\n", module_max + 1)
+	print ""
+	print "_Static_assert(TDX_MODULES_COUNT - 1 <= TDX_PID4_MAX,"
+	print "\t       \"module ids are 4 digit pid4s\");"
+	printf("_Static_assert(%s <= TDX_PID4_MAX && %s <= TDX_PID4_MAX,\n",
+	       enum_of["carrier", carriers[ncarriers]],
+	       enum_of["display", displays[ndisplays]])
+	print "\t       \"product ids are 4 digit pid4s\");"
+	print ""
+
+	print "#define TARGET_IS_ENABLED(x) (1)"
+	print ""
+	print "const struct toradex_som toradex_modules[TDX_MODULES_COUNT] = {"
+	for (id = 0; id <= module_max; id++) {
+		if (("module", id) in enum_of) {
+			slot = "[" enum_of["module", id] "]"
+			name = name_of["module", id]
+			en = family_of[id] == "-" ? "0" : \
+			     "TARGET_IS_ENABLED(" family_of[id] ")"
+		} else {
+			slot = "[" id "]"
+			name = "UNKNOWN MODULE"
+			en = "0"
+		}
+		printf("\t%s = { \"%s\", %s },\n", slot, name, en)
+	}
+	print "};"
+	print ""
+
+	print "/* Modules that can be selected, in product id order */"
+	print "const uint16_t toradex_modules_enabled[] = {"
+	for (id = 1; id <= module_max; id++) {
+		if (("module", id) in enum_of && family_of[id] != "-") {
+			printf("\t%s,\n", enum_of["module", id])
+			p = add_product("TDX_EEPROM_ID_MODULE", enum_of["module", id])
+			add_words(name_of["module", id], p)
+			add_words(family_of[id], p)
+		}
+	}
+	print "};"
+	print ""
+
+	print_pid4list("carrier", "toradex_carrier_boards",
+		       "UNKNOWN CARRIER BOARD", carriers, ncarriers)
+	for (i = 1; i <= ncarriers; i++) {
+		p = add_product("TDX_EEPROM_ID_CARRIER",
+				enum_of["carrier", carriers[i]])
+		add_words(name_of["carrier", carriers[i]], p)
+	}
+
+	print_pid4list("display", "toradex_display_adapters",
+		       "UNKNOWN DISPLAY ADAPTER", displays, ndisplays)
+	for (i = 1; i <= ndisplays; i++) {
+		p = add_product("TDX_EEPROM_ID_DISPLAY_ADAPTER",
+				enum_of["display", displays[i]])
+		add_words(name_of["display", displays[i]], p)
+	}
+
+	print "static const u32 toradex_ouis[] = {"
+	for (i = 0; i < nouis; i++)
+		printf("\t[%d] = %sUL,\n", i, ouis[i])
+	print "};"
+	print ""
+
+	words = int((nproducts + 31) / 32)
+	printf("#define TDX_SEARCH_PRODUCTS\t%d\n", nproducts)
+	printf("#define TDX_SEARCH_WORDS\t%d\n", words)
+	print ""
+	print "struct tdx_search_product {"
+	print "\tuint16_t type;"
+	print "\tuint16_t pid4;"
+	print "};"
+	print ""
+	print "struct tdx_search_token {"
+	print "\tconst char *word;"
+	print "\tuint32_t products[TDX_SEARCH_WORDS];"
+	print "};"
+	print ""
+	print "/* Products that list --search can find, bit n of a token is entry n */"
+	print "static const struct tdx_search_product tdx_search_products[] = {"
+	for (p = 0; p < nproducts; p++)
+		printf("\t{ %s, %s },\n", products_type[p], products_id[p])
+	print "};"
+	print ""
+	print "/* Lower case words of the product names and families, in strcmp() order */"
+	print "static const struct tdx_search_token tdx_search_tokens[] = {"
+	sort_strings(tokens, ntokens)
+	for (i = 1; i <= ntokens; i++) {
+		line = sprintf("\t{ \"%s\", {", tokens[i])
+		for (j = 0; j < words; j++)
+			line = line sprintf(" 0x%08x,", token_bits[tokens[i], j])
+		print line " } },"
+	}
+	print "};"
+	print ""
+	print "#endif /* _TDX_CFG_BLOCK_DATA_H */"
+}
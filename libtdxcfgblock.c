@@ -0,0 +1,897 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * libtdxcfgblock - Toradex config block codec, see tdx-cfgblock.h
+ */
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tdx-cfgblock.h"
+#include "tdx-trace.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+#define BITS_PER_LONG 32
+#define GENMASK(h, l) \
+	(((~0UL) << (l)) & (~0UL >> (BITS_PER_LONG - 1 - (h))))
+
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+#include "tdx-cfgdata.h"
+
+const unsigned int toradex_modules_count = ARRAY_SIZE(toradex_modules);
+const unsigned int toradex_modules_enabled_count =
+	ARRAY_SIZE(toradex_modules_enabled);
+const unsigned int toradex_carrier_boards_count =
+	ARRAY_SIZE(toradex_carrier_boards);
+const unsigned int toradex_display_adapters_count =
+	ARRAY_SIZE(toradex_display_adapters);
+
+char *tdx_get_board_assembly_r(u16 ver_assembly, char *buf, size_t size)
+{
+	if (ver_assembly < 26)
+		snprintf(buf, size, "%c", (char)ver_assembly + 'A');
+	else
+		snprintf(buf, size, "#%u", ver_assembly);
+
+	return buf;
+}
+
+const char *tdx_get_carrier_boards(int pid4)
+{
+	unsigned int i = pid4 - TDX_CARRIER_PID4_BASE;
+	int index = 0;
+
+	if (i < ARRAY_SIZE(toradex_carrier_boards_pid4))
+		index = toradex_carrier_boards_pid4[i];
+	return toradex_carrier_boards[index].name;
+}
+
+const char *tdx_get_display_adapters(int pid4)
+{
+	unsigned int i = pid4 - TDX_DISPLAY_PID4_BASE;
+	int index = 0;
+
+	if (i < ARRAY_SIZE(toradex_display_adapters_pid4))
+		index = toradex_display_adapters_pid4[i];
+	return toradex_display_adapters[index].name;
+}
+
+/* First search token that doesn't sort before word */
+static unsigned int tdx_search_lower_bound(const char *word)
+{
+	unsigned int lo = 0, hi = ARRAY_SIZE(tdx_search_tokens), mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(tdx_search_tokens[mid].word, word) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+unsigned int tdx_product_search(u32 type, const char *query, int *pid4s,
+				unsigned int max)
+{
+	u32 match[TDX_SEARCH_WORDS], any[TDX_SEARCH_WORDS];
+	char word[32];
+	unsigned int i, j, n, len;
+
+	memset(match, 0xff, sizeof(match));
+	for (;;) {
+		while (*query && !isalnum((unsigned char)*query))
+			query++;
+		if (!*query)
+			break;
+
+		for (len = 0; isalnum((unsigned char)*query); query++, len++) {
+			if (len == sizeof(word) - 1)
+				return 0;	/* longer than any token */
+			word[len] = tolower((unsigned char)*query);
+		}
+		word[len] = '\0';
+
+		/* Tokens starting with word are adjacent in sorted order */
+		memset(any, 0, sizeof(any));
+		for (i = tdx_search_lower_bound(word);
+		     i < ARRAY_SIZE(tdx_search_tokens) &&
+		     !strncmp(tdx_search_tokens[i].word, word, len); i++) {
+			for (j = 0; j < TDX_SEARCH_WORDS; j++)
+				any[j] |= tdx_search_tokens[i].products[j];
+		}
+		for (j = 0; j < TDX_SEARCH_WORDS; j++)
+			match[j] &= any[j];
+	}
+
+	for (i = 0, n = 0; i < TDX_SEARCH_PRODUCTS; i++) {
+		if (!(match[i / 32] & (1U << (i % 32))) ||
+		    tdx_search_products[i].type != type)
+			continue;
+		if (n < max)
+			pid4s[n] = tdx_search_products[i].pid4;
+		n++;
+	}
+	return n;
+}
+
+u32 tdx_get_serial_from_mac(const struct toradex_eth_addr *eth_addr)
+{
+	int i;
+	u32 oui = ntohl(eth_addr->oui) >> 8;
+	u32 nic = ntohl(eth_addr->nic) >> 8;
+
+	for (i = 0; i < ARRAY_SIZE(toradex_ouis); i++) {
+		if (toradex_ouis[i] == oui)
+			break;
+	}
+
+	return (u32)((i << 24) + nic);
+}
+
+int tdx_get_mac_from_serial(u32 tdx_serial, struct toradex_eth_addr *eth_addr)
+{
+	u8 oui_index = tdx_serial >> 24;
+	u32 nic = tdx_serial & GENMASK(23, 0);
+	u32 oui;
+	int ret = 0;
+
+	if (oui_index >= ARRAY_SIZE(toradex_ouis)) {
+		oui_index = 0;
+		ret = -ERANGE;
+	}
+
+	oui = toradex_ouis[oui_index];
+
+	eth_addr->oui = htonl(oui << 8);
+	eth_addr->nic = htonl(nic << 8);
+
+	return ret;
+}
+
+const char * const tdx_barcode_error[TDX_BARCODE_ERROR_COUNT] = {
+	[TDX_BARCODE_OK]	= "ok",
+	[TDX_BARCODE_LENGTH]	= "barcode is not 16 digits long",
+	[TDX_BARCODE_DIGITS]	= "barcode has non-digit characters",
+	[TDX_BARCODE_PRODID]	= "unknown or disabled product id",
+	[TDX_BARCODE_REVISION]	= "invalid revision",
+	[TDX_BARCODE_SERIAL]	= "serial number outside the known OUIs",
+};
+
+#define SWAR_ONES	0x0101010101010101ULL
+
+/* 8 characters, first one in the low byte */
+static inline uint64_t tdx_load_digits(const char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/* All 8 bytes in '0'..'9': high nibble 3, still 3 after adding 6 */
+static inline int tdx_swar_digits(uint64_t v)
+{
+	const uint64_t high = 0xf0 * SWAR_ONES;
+
+	return (v & high) == 0x30 * SWAR_ONES &&
+	       ((v + 0x06 * SWAR_ONES) & high) == 0x30 * SWAR_ONES;
+}
+
+/* Value of 8 decimal digits, combining neighbours 1, 2 then 4 at a time */
+static inline u32 tdx_swar_value(uint64_t v)
+{
+	v -= 0x30 * SWAR_ONES;
+	v = (v * 10 + (v >> 8)) & 0x00ff00ff00ff00ffULL;
+	v = (v * 100 + (v >> 16)) & 0x0000ffff0000ffffULL;
+	v = (v * 10000 + (v >> 32)) & 0xffffffffULL;
+	return v;
+}
+
+int tdx_barcode_decode(const char *barcode, size_t len, struct toradex_hw *hw,
+		       u32 *serial)
+{
+	uint64_t lo, hi;
+	u32 first;
+
+	if (len != 16)
+		return TDX_BARCODE_LENGTH;
+
+	lo = tdx_load_digits(barcode);
+	hi = tdx_load_digits(barcode + 8);
+	if (!tdx_swar_digits(lo) || !tdx_swar_digits(hi))
+		return TDX_BARCODE_DIGITS;
+
+	/* pppp M m aa: product id, version major, minor and assembly */
+	first = tdx_swar_value(lo);
+	hw->prodid = first / 10000;
+	hw->ver_major = first / 1000 % 10;
+	hw->ver_minor = first / 100 % 10;
+	hw->ver_assembly = first % 100;
+	*serial = tdx_swar_value(hi);
+
+	return TDX_BARCODE_OK;
+}
+
+int tdx_barcode_check(u32 type, const struct toradex_hw *hw, u32 serial)
+{
+	unsigned int i;
+
+	switch (type) {
+	case TDX_EEPROM_ID_MODULE:
+		if (hw->prodid >= ARRAY_SIZE(toradex_modules) ||
+		    !toradex_modules[hw->prodid].is_enabled)
+			return TDX_BARCODE_PRODID;
+		/* The top byte of a module serial selects the MAC OUI */
+		if (serial >> 24 >= ARRAY_SIZE(toradex_ouis))
+			return TDX_BARCODE_SERIAL;
+		break;
+	case TDX_EEPROM_ID_CARRIER:
+		i = hw->prodid - TDX_CARRIER_PID4_BASE;
+		if (i >= ARRAY_SIZE(toradex_carrier_boards_pid4) ||
+		    !toradex_carrier_boards_pid4[i])
+			return TDX_BARCODE_PRODID;
+		break;
+	case TDX_EEPROM_ID_DISPLAY_ADAPTER:
+		i = hw->prodid - TDX_DISPLAY_PID4_BASE;
+		if (i >= ARRAY_SIZE(toradex_display_adapters_pid4) ||
+		    !toradex_display_adapters_pid4[i])
+			return TDX_BARCODE_PRODID;
+		break;
+	default:
+		return TDX_BARCODE_PRODID;
+	}
+
+	/* Hardware versions start at V1.0 */
+	if (!hw->ver_major)
+		return TDX_BARCODE_REVISION;
+
+	return TDX_BARCODE_OK;
+}
+
+int tdx_parse_cfg_block(const u8 *config_block, size_t avail,
+	size_t size, u32 want, struct tdx_data *data, size_t *need)
+{
+	struct toradex_tag *tag;
+	size_t offset;
+	u32 found = 0;
+
+	/* Expect a valid tag first */
+	if (avail < sizeof(struct toradex_tag)) {
+		*need = sizeof(struct toradex_tag);
+		return -EAGAIN;
+	}
+
+	tag = (struct toradex_tag *)config_block;
+	if (tag->flags != TDX_TAG_FLAG_VALID || tag->id != TDX_TAG_VALID)
+		return -EINVAL;
+	offset = 4;
+
+	/*
+	 * check if there is enough space for storing tag and value of the
+	 * biggest element
+	 */
+	while (offset + sizeof(struct toradex_tag) +
+	       sizeof(struct toradex_hw) < size) {
+		size_t payload_len = 0;
+		u32 bit = 0;
+
+		if (avail < offset + 4) {
+			*need = offset + 4;
+			return -EAGAIN;
+		}
+
+		tag = (struct toradex_tag *)(config_block + offset);
+		offset += 4;
+		if (tag->id == TDX_TAG_INVALID)
+			break;
+
+		if (tag->flags == TDX_TAG_FLAG_VALID) {
+			switch (tag->id) {
+			case TDX_TAG_MAC:
+				bit = TDX_WANT_MAC;
+				payload_len = 6;
+				break;
+			case TDX_TAG_HW:
+				bit = want & (TDX_WANT_HW | TDX_WANT_CAR_HW);
+				payload_len = 8;
+				break;
+			case TDX_TAG_CAR_SERIAL:
+				bit = TDX_WANT_CAR_SERIAL;
+				payload_len = sizeof(data->car_serial);
+				break;
+			}
+		}
+
+		if (want & bit) {
+			/* Fetch the next tag header along with the payload */
+			if (avail < offset + payload_len) {
+				*need = offset + payload_len + 4;
+				return -EAGAIN;
+			}
+
+			/* Tag id, payload length and offset */
+			TDX_TRACE3(tag, (int)tag->id, (int)(tag->len * 4),
+				   (int)offset);
+
+			switch (bit) {
+			case TDX_WANT_MAC:
+				memcpy(&data->eth_addr, config_block + offset,
+				       6);
+
+				data->serial =
+					tdx_get_serial_from_mac(&data->eth_addr);
+				break;
+			case TDX_WANT_HW:
+				memcpy(&data->hw_tag, config_block + offset, 8);
+				break;
+			case TDX_WANT_CAR_HW:
+				memcpy(&data->car_hw_tag, config_block + offset,
+				       8);
+				break;
+			case TDX_WANT_CAR_SERIAL:
+				memcpy(&data->car_serial, config_block + offset,
+				       sizeof(data->car_serial));
+				break;
+			}
+
+			found |= bit;
+			if ((found & want) == want)
+				break;
+		}
+
+		/* Get to next tag according to current tags length */
+		offset += tag->len * 4;
+	}
+
+	/* A valid header alone is not a config block */
+	if (!(found & want))
+		return -ENOENT;
+
+	/* Cap product id to avoid issues with a yet unknown one */
+	if ((want & TDX_WANT_HW) &&
+	    data->hw_tag.prodid >= ARRAY_SIZE(toradex_modules))
+		data->hw_tag.prodid = 0;
+
+	return 0;
+}
+
+u32 tdx_data_want_all(u32 type)
+{
+	/* Display adapters use the carrier config block layout */
+	return type == TDX_EEPROM_ID_MODULE ? TDX_WANT_MODULE : TDX_WANT_CARRIER;
+}
+
+/*
+ * Batch decoding of config blocks laid out at a fixed stride, as found in
+ * dumps and generated images. Almost every such block has the layout written
+ * by create: the valid header, the product tag at offset 4 and the MAC
+ * (module) or serial (carrier) tag at offset 16. The kernel checks the three
+ * tag words of several blocks at once against that layout, without
+ * branching per block, and copies the payloads from their fixed offsets.
+ * Blocks with a valid header but another layout go through
+ * tdx_parse_cfg_block(), so the results are the same as decoding each block
+ * with it.
+ */
+#define TDX_TLV_PRODUCT		4
+#define TDX_TLV_SECOND		16
+#define TDX_TLV_MIN_STRIDE	32
+
+#define TDX_TLV_HEADER_OK	(1 << 0)
+#define TDX_TLV_CANONICAL	(1 << 1)
+
+const char * const tdx_tlv_impl_name[TDX_TLV_IMPL_COUNT] = {
+	"scalar", "sse2", "avx2", "neon",
+};
+
+struct tdx_tlv_layout {
+	u32 mask;	/* flags and id, tag length ignored */
+	u32 header;
+	u32 product;
+	u32 second;
+};
+
+static u32 tdx_tag_word(u16 id, u8 flags, u16 len)
+{
+	struct toradex_tag tag = { .len = len, .flags = flags, .id = id };
+	u32 word;
+
+	memcpy(&word, &tag, sizeof(word));
+	return word;
+}
+
+static void tdx_tlv_layout(u32 type, struct tdx_tlv_layout *layout)
+{
+	layout->mask = tdx_tag_word(0xffff, 0x3, 0);
+	layout->header = tdx_tag_word(TDX_TAG_VALID, TDX_TAG_FLAG_VALID, 0);
+	/* The length decides where the next tag is, so it has to match */
+	layout->product = tdx_tag_word(TDX_TAG_HW, TDX_TAG_FLAG_VALID, 2);
+	if (type == TDX_EEPROM_ID_MODULE)
+		layout->second = tdx_tag_word(TDX_TAG_MAC,
+					      TDX_TAG_FLAG_VALID, 0);
+	else
+		layout->second = tdx_tag_word(TDX_TAG_CAR_SERIAL,
+					      TDX_TAG_FLAG_VALID, 0);
+}
+
+static inline u32 tdx_load_word(const u8 *p)
+{
+	u32 word;
+
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+static void tdx_tlv_classify_scalar(const u8 *blocks, size_t stride,
+	size_t count, const struct tdx_tlv_layout *layout, u8 *class)
+{
+	for (size_t i = 0; i < count; i++) {
+		const u8 *b = blocks + i * stride;
+		u32 ok = (tdx_load_word(b) & layout->mask) == layout->header;
+		u32 canonical = ok &
+			(tdx_load_word(b + TDX_TLV_PRODUCT) == layout->product) &
+			((tdx_load_word(b + TDX_TLV_SECOND) & layout->mask) ==
+			 layout->second);
+
+		class[i] = ok | canonical << 1;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void tdx_tlv_classify_sse2(const u8 *blocks, size_t stride,
+	size_t count, const struct tdx_tlv_layout *layout, u8 *class)
+{
+	const __m128i mask = _mm_set1_epi32(layout->mask);
+	const __m128i header = _mm_set1_epi32(layout->header);
+	const __m128i product = _mm_set1_epi32(layout->product);
+	const __m128i second = _mm_set1_epi32(layout->second);
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		const u8 *b = blocks + i * stride;
+		__m128i w0, w1, w2, ok, canonical;
+		int ok_bits, canonical_bits;
+
+		w0 = _mm_setr_epi32(tdx_load_word(b),
+				    tdx_load_word(b + stride),
+				    tdx_load_word(b + 2 * stride),
+				    tdx_load_word(b + 3 * stride));
+		b += TDX_TLV_PRODUCT;
+		w1 = _mm_setr_epi32(tdx_load_word(b),
+				    tdx_load_word(b + stride),
+				    tdx_load_word(b + 2 * stride),
+				    tdx_load_word(b + 3 * stride));
+		b += TDX_TLV_SECOND - TDX_TLV_PRODUCT;
+		w2 = _mm_setr_epi32(tdx_load_word(b),
+				    tdx_load_word(b + stride),
+				    tdx_load_word(b + 2 * stride),
+				    tdx_load_word(b + 3 * stride));
+
+		ok = _mm_cmpeq_epi32(_mm_and_si128(w0, mask), header);
+		canonical = _mm_and_si128(ok, _mm_cmpeq_epi32(w1, product));
+		canonical = _mm_and_si128(canonical,
+			_mm_cmpeq_epi32(_mm_and_si128(w2, mask), second));
+
+		ok_bits = _mm_movemask_ps(_mm_castsi128_ps(ok));
+		canonical_bits = _mm_movemask_ps(_mm_castsi128_ps(canonical));
+		for (int j = 0; j < 4; j++)
+			class[i + j] = ((ok_bits >> j) & 1) |
+				       ((canonical_bits >> j) & 1) << 1;
+	}
+
+	tdx_tlv_classify_scalar(blocks + i * stride, stride, count - i,
+				layout, class + i);
+}
+
+__attribute__((target("avx2")))
+static void tdx_tlv_classify_avx2(const u8 *blocks, size_t stride,
+	size_t count, const struct tdx_tlv_layout *layout, u8 *class)
+{
+	const __m256i mask = _mm256_set1_epi32(layout->mask);
+	const __m256i header = _mm256_set1_epi32(layout->header);
+	const __m256i product = _mm256_set1_epi32(layout->product);
+	const __m256i second = _mm256_set1_epi32(layout->second);
+	const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3,
+								    4, 5, 6, 7),
+						 _mm256_set1_epi32(stride));
+	size_t i;
+
+	/* Gather indices are 32 bit, which is plenty for 8 blocks */
+	if (stride > INT_MAX / 8) {
+		tdx_tlv_classify_scalar(blocks, stride, count, layout, class);
+		return;
+	}
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		const u8 *b = blocks + i * stride;
+		__m256i w0, w1, w2, ok, canonical;
+		int ok_bits, canonical_bits;
+
+		w0 = _mm256_i32gather_epi32((const int *)b, index, 1);
+		w1 = _mm256_i32gather_epi32((const int *)(b + TDX_TLV_PRODUCT),
+					    index, 1);
+		w2 = _mm256_i32gather_epi32((const int *)(b + TDX_TLV_SECOND),
+					    index, 1);
+
+		ok = _mm256_cmpeq_epi32(_mm256_and_si256(w0, mask), header);
+		canonical = _mm256_and_si256(ok,
+					     _mm256_cmpeq_epi32(w1, product));
+		canonical = _mm256_and_si256(canonical,
+			_mm256_cmpeq_epi32(_mm256_and_si256(w2, mask), second));
+
+		ok_bits = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+		canonical_bits =
+			_mm256_movemask_ps(_mm256_castsi256_ps(canonical));
+		for (int j = 0; j < 8; j++)
+			class[i + j] = ((ok_bits >> j) & 1) |
+				       ((canonical_bits >> j) & 1) << 1;
+	}
+
+	tdx_tlv_classify_scalar(blocks + i * stride, stride, count - i,
+				layout, class + i);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+
+static void tdx_tlv_classify_neon(const u8 *blocks, size_t stride,
+	size_t count, const struct tdx_tlv_layout *layout, u8 *class)
+{
+	const uint32x4_t mask = vdupq_n_u32(layout->mask);
+	const uint32x4_t header = vdupq_n_u32(layout->header);
+	const uint32x4_t product = vdupq_n_u32(layout->product);
+	const uint32x4_t second = vdupq_n_u32(layout->second);
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		const u8 *b = blocks + i * stride;
+		u32 words[3][4], ok_lanes[4], canonical_lanes[4];
+		uint32x4_t ok, canonical;
+
+		for (int j = 0; j < 4; j++) {
+			words[0][j] = tdx_load_word(b + j * stride);
+			words[1][j] = tdx_load_word(b + j * stride +
+						    TDX_TLV_PRODUCT);
+			words[2][j] = tdx_load_word(b + j * stride +
+						    TDX_TLV_SECOND);
+		}
+
+		ok = vceqq_u32(vandq_u32(vld1q_u32(words[0]), mask), header);
+		canonical = vandq_u32(ok, vceqq_u32(vld1q_u32(words[1]),
+						    product));
+		canonical = vandq_u32(canonical,
+			vceqq_u32(vandq_u32(vld1q_u32(words[2]), mask), second));
+
+		vst1q_u32(ok_lanes, ok);
+		vst1q_u32(canonical_lanes, canonical);
+		for (int j = 0; j < 4; j++)
+			class[i + j] = (ok_lanes[j] & 1) |
+				       (canonical_lanes[j] & 1) << 1;
+	}
+
+	tdx_tlv_classify_scalar(blocks + i * stride, stride, count - i,
+				layout, class + i);
+}
+#endif
+
+/* Fastest classifier this CPU supports */
+int tdx_tlv_best_impl(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return TDX_TLV_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return TDX_TLV_SSE2;
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+	return TDX_TLV_NEON;
+#endif
+	return TDX_TLV_SCALAR;
+}
+
+int tdx_tlv_impl_supported(int impl)
+{
+	switch (impl) {
+	case TDX_TLV_SCALAR:
+		return 1;
+#if defined(__x86_64__) || defined(__i386__)
+	case TDX_TLV_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case TDX_TLV_AVX2:
+		return __builtin_cpu_supports("avx2");
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+	case TDX_TLV_NEON:
+		return 1;
+#endif
+	}
+
+	return 0;
+}
+
+static void tdx_tlv_classify(int impl, const u8 *blocks, size_t stride,
+	size_t count, const struct tdx_tlv_layout *layout, u8 *class)
+{
+	switch (impl) {
+#if defined(__x86_64__) || defined(__i386__)
+	case TDX_TLV_SSE2:
+		tdx_tlv_classify_sse2(blocks, stride, count, layout, class);
+		return;
+	case TDX_TLV_AVX2:
+		tdx_tlv_classify_avx2(blocks, stride, count, layout, class);
+		return;
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+	case TDX_TLV_NEON:
+		tdx_tlv_classify_neon(blocks, stride, count, layout, class);
+		return;
+#endif
+	}
+
+	tdx_tlv_classify_scalar(blocks, stride, count, layout, class);
+}
+
+#define TDX_TLV_BATCH	256
+
+size_t tdx_decode_cfg_blocks(int impl, const u8 *blocks, size_t stride,
+	size_t count, u32 type, struct tdx_data *data, int *ret)
+{
+	u32 want = tdx_data_want_all(type);
+	struct tdx_tlv_layout layout;
+	u8 class[TDX_TLV_BATCH];
+	size_t valid = 0;
+
+	tdx_tlv_layout(type, &layout);
+
+	for (size_t first = 0; first < count; first += TDX_TLV_BATCH) {
+		size_t n = count - first;
+
+		if (n > TDX_TLV_BATCH)
+			n = TDX_TLV_BATCH;
+
+		if (stride >= TDX_TLV_MIN_STRIDE)
+			tdx_tlv_classify(impl, blocks + first * stride, stride,
+					 n, &layout, class);
+		else
+			memset(class, TDX_TLV_HEADER_OK, n);
+
+		for (size_t i = first; i < first + n; i++) {
+			const u8 *b = blocks + i * stride;
+			struct tdx_data *d = &data[i];
+			size_t need;
+
+			memset(d, 0, sizeof(*d));
+
+			switch (class[i - first]) {
+			case TDX_TLV_HEADER_OK | TDX_TLV_CANONICAL:
+				ret[i] = 0;
+				if (type != TDX_EEPROM_ID_MODULE) {
+					memcpy(&d->car_hw_tag, b + 8, 8);
+					memcpy(&d->car_serial, b + 20,
+					       sizeof(d->car_serial));
+					break;
+				}
+
+				memcpy(&d->hw_tag, b + 8, 8);
+				memcpy(&d->eth_addr, b + 20, 6);
+				d->serial =
+					tdx_get_serial_from_mac(&d->eth_addr);
+				if (d->hw_tag.prodid >= ARRAY_SIZE(toradex_modules))
+					d->hw_tag.prodid = 0;
+				break;
+			case TDX_TLV_HEADER_OK:
+				ret[i] = tdx_parse_cfg_block(b, stride, stride,
+							     want, d, &need);
+				break;
+			default:
+				ret[i] = -EINVAL;
+				break;
+			}
+
+			valid += !ret[i];
+		}
+	}
+
+	return valid;
+}
+
+int tdx_write_tag(u8 *config_block, int *offset, int tag_id,
+		  const u8 *tag_data, size_t tag_data_size)
+{
+	struct toradex_tag *tag;
+
+	if (!offset || !config_block)
+		return -EINVAL;
+
+	TDX_TRACE3(write_tag, tag_id, (int)tag_data_size, *offset);
+
+	tag = (struct toradex_tag *)(config_block + *offset);
+	tag->id = tag_id;
+	tag->flags = TDX_TAG_FLAG_VALID;
+	/* len is provided as number of 32bit values after the tag */
+	tag->len = (tag_data_size + sizeof(u32) - 1) / sizeof(u32);
+	*offset += sizeof(struct toradex_tag);
+	if (tag_data && tag_data_size) {
+		memcpy(config_block + *offset, tag_data,
+		       tag_data_size);
+		*offset += tag_data_size;
+	}
+
+	return 0;
+}
+
+int tdx_encode_cfg_block(u8 *config_block, size_t size,
+	struct tdx_data *data)
+{
+	int offset = 0;
+	int ret;
+
+	if (size < TDX_CFG_BLOCK_MIN_SIZE)
+		return -EINVAL;
+
+	memset(config_block, 0xff, size);
+
+	/* Convert serial number to MAC address (the storage format) */
+	ret = tdx_get_mac_from_serial(data->serial, &data->eth_addr);
+
+	/* Valid Tag */
+	tdx_write_tag(config_block, &offset, TDX_TAG_VALID, NULL, 0);
+
+	/* Product Tag */
+	tdx_write_tag(config_block, &offset, TDX_TAG_HW, (u8 *)&data->hw_tag,
+		      sizeof(data->hw_tag));
+
+	/* MAC Tag */
+	tdx_write_tag(config_block, &offset, TDX_TAG_MAC,
+		      (u8 *)&data->eth_addr, sizeof(data->eth_addr));
+
+	memset(config_block + offset, 0, TDX_CFG_BLOCK_MIN_SIZE - offset);
+
+	return ret;
+}
+
+int tdx_encode_cfg_block_carrier(u8 *config_block, size_t size,
+	struct tdx_data *data)
+{
+	int offset = 0;
+
+	if (size < TDX_CFG_BLOCK_MIN_SIZE)
+		return -EINVAL;
+
+	memset(config_block, 0xff, size);
+
+	/* Valid Tag */
+	tdx_write_tag(config_block, &offset, TDX_TAG_VALID, NULL, 0);
+
+	/* Product Tag */
+	tdx_write_tag(config_block, &offset, TDX_TAG_HW,
+		      (u8 *)&data->car_hw_tag, sizeof(data->car_hw_tag));
+
+	/* Serial Tag */
+	tdx_write_tag(config_block, &offset, TDX_TAG_CAR_SERIAL,
+		      (u8 *)&data->car_serial, sizeof(data->car_serial));
+
+	memset(config_block + offset, 0, TDX_CFG_BLOCK_MIN_SIZE - offset);
+
+	return 0;
+}
+
+int tdx_find_tag(const u8 *config_block, size_t avail, size_t size,
+	u16 id, size_t payload_len)
+{
+	struct toradex_tag *tag;
+	size_t offset = 4;
+
+	while (offset + sizeof(struct toradex_tag) +
+	       sizeof(struct toradex_hw) < size) {
+		if (offset + 4 > avail)
+			break;
+
+		tag = (struct toradex_tag *)(config_block + offset);
+		offset += 4;
+		if (tag->id == TDX_TAG_INVALID)
+			break;
+
+		if (tag->flags == TDX_TAG_FLAG_VALID && tag->id == id) {
+			if (tag->len * 4 < payload_len ||
+			    offset + payload_len > avail)
+				return -ENOENT;
+			return offset;
+		}
+
+		offset += tag->len * 4;
+	}
+
+	return -ENOENT;
+}
+
+/* Open addressing over the small slot table, ids are 16 bit */
+static unsigned int tdx_tlv_slot(u16 id)
+{
+	return ((u32)id * 0x9e37u >> 8) & (TDX_TLV_INDEX_SLOTS - 1);
+}
+
+int tdx_tlv_index_build(const u8 *config_block, size_t size,
+	struct tdx_tlv_index *index)
+{
+	const struct toradex_tag *tag;
+	size_t offset = 4;
+
+	index->count = 0;
+	memset(index->slot, 0, sizeof(index->slot));
+
+	if (size < sizeof(*tag))
+		return -EINVAL;
+
+	tag = (const struct toradex_tag *)config_block;
+	if (tag->flags != TDX_TAG_FLAG_VALID || tag->id != TDX_TAG_VALID)
+		return -EINVAL;
+
+	/* Same walk as tdx_parse_cfg_block() */
+	while (offset + sizeof(struct toradex_tag) +
+	       sizeof(struct toradex_hw) < size) {
+		struct tdx_tlv_entry *entry;
+		size_t len;
+
+		tag = (const struct toradex_tag *)(config_block + offset);
+		offset += 4;
+		if (tag->id == TDX_TAG_INVALID)
+			break;
+
+		if (index->count == TDX_TLV_INDEX_MAX)
+			return -E2BIG;
+
+		/* A length running past the block is cut at its end */
+		len = tag->len * 4;
+		if (offset + len > size)
+			len = size - offset;
+
+		entry = &index->tags[index->count++];
+		entry->id = tag->id;
+		entry->flags = tag->flags;
+		entry->offset = offset;
+		entry->len = len;
+
+		/* Lookups return the first valid tag, like the parser */
+		if (tag->flags == TDX_TAG_FLAG_VALID) {
+			unsigned int slot = tdx_tlv_slot(tag->id);
+
+			while (index->slot[slot] &&
+			       index->tags[index->slot[slot] - 1].id != tag->id)
+				slot = (slot + 1) & (TDX_TLV_INDEX_SLOTS - 1);
+			if (!index->slot[slot])
+				index->slot[slot] = index->count;
+		}
+
+		offset += tag->len * 4;
+	}
+
+	return 0;
+}
+
+const struct tdx_tlv_entry *tdx_tlv_lookup(const struct tdx_tlv_index *index,
+	u16 id)
+{
+	unsigned int slot = tdx_tlv_slot(id);
+
+	while (index->slot[slot]) {
+		const struct tdx_tlv_entry *entry =
+			&index->tags[index->slot[slot] - 1];
+
+		if (entry->id == id)
+			return entry;
+		slot = (slot + 1) & (TDX_TLV_INDEX_SLOTS - 1);
+	}
+
+	return NULL;
+}
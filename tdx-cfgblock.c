@@ -4,10 +4,17 @@
  * Copyright (c) 2024 Savoir-Faire Linux
  */
 
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -15,6 +22,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "tdx-cfgblock.h"
+
+#define TDX_TRACE_SEMAPHORES
+#include "tdx-trace.h"
 
 #define CONFIG_TDX_CFG_BLOCK_IS_IN_EEPROM
 #define ARCH_DMA_MINALIGN 4
@@ -33,38 +58,11 @@
 #define CMD_RET_FAILURE 1
 #define CMD_RET_USAGE 2
 
+typedef uint64_t u64;
 typedef uint32_t u32;
 typedef uint16_t u16;
 typedef uint8_t u8;
 
-struct toradex_hw {
-	u16 ver_major;
-	u16 ver_minor;
-	u16 ver_assembly;
-	u16 prodid;
-};
-
-struct toradex_eth_addr {
-	u32 oui:24;
-	u32 nic:24;
-} __attribute__((__packed__));
-
-struct toradex_som {
-	const char *name;
-	int is_enabled;
-};
-
-#define TAG_VALID	0xcf01
-#define TAG_MAC		0x0000
-#define TAG_CAR_SERIAL	0x0021
-#define TAG_HW		0x0008
-#define TAG_INVALID	0xffff
-
-#define TAG_FLAG_VALID	0x1
-
-#define TDX_EEPROM_ID_MODULE		0
-#define TDX_EEPROM_ID_CARRIER		1
-
 #if defined(CONFIG_TDX_CFG_BLOCK_IS_IN_MMC)
 #define TDX_CFG_BLOCK_MAX_SIZE 512
 #elif defined(CONFIG_TDX_CFG_BLOCK_IS_IN_NAND)
@@ -79,29 +77,21 @@ struct toradex_som {
 
 #define TDX_CFG_BLOCK_EXTRA_MAX_SIZE 64
 
-struct toradex_tag {
-	u32 len:14;
-	u32 flags:2;
-	u32 id:16;
-};
+/* Config blocks are staged on the stack, this also bounds --size */
+#define TDX_CFG_BLOCK_BUF_SIZE 4096
+#define __aligned_dma __attribute__((aligned(ARCH_DMA_MINALIGN)))
 
-struct pid4list {
-	int pid4;
-	char * const name;
-};
+#define TDX_FIELD_NAME_LEN	32
+#define TDX_FIELD_VALUE_LEN	64
+#define TDX_FIELDS_PER_BLOCK	4
 
-struct tdx_data {
-	struct toradex_hw hw_tag;
-	struct toradex_hw car_hw_tag;
-	struct toradex_eth_addr eth_addr;
-	u32 serial;
-	u32 car_serial;
+struct tdx_field {
+	char name[TDX_FIELD_NAME_LEN];
+	char value[TDX_FIELD_VALUE_LEN];
 };
 
 char console_buffer[255];
 
-#include "tdx-cfgdata.h"
-
 static unsigned long dectoul(const char *cp, char **endp)
 {
 	return atol(cp);
@@ -117,233 +107,616 @@ static int cli_readline(const char *const prompt)
 	return strlen(console_buffer);
 }
 
-static const char *get_board_assembly(u16 ver_assembly)
-{
-	static char ver_name[MODULE_REV_STR_LEN + 1];
+struct non_volatile_device {
+	int type;
+	const char* path;
+	off_t offset;
+	/* Config block size, 0 for the default of the block type */
+	size_t size;
+	/* Access through mmap() instead of pread()/pwrite() */
+	int mmap;
+};
 
-	if (ver_assembly < 26) {
-		ver_name[0] = (char)ver_assembly + 'A';
-		ver_name[1] = '\0';
-	} else {
-		snprintf(ver_name, sizeof(ver_name),
-			 "#%u", ver_assembly);
-	}
+const struct non_volatile_device nv_devs[] = {
+	{TDX_EEPROM_ID_MODULE, "/dev/mmcblk2boot0", 0x3ffe00},
+	{TDX_EEPROM_ID_CARRIER, "/sys/bus/nvmem/devices/3-00573/nvmem", 0},
+	{TDX_EEPROM_ID_CARRIER, "/sys/bus/nvmem/devices/3-00513/nvmem", 0},
+};
 
-	return ver_name;
-}
+static const char * const nv_dev_type_name[] = {
+	[TDX_EEPROM_ID_MODULE] = "module",
+	[TDX_EEPROM_ID_CARRIER] = "carrier",
+	[TDX_EEPROM_ID_DISPLAY_ADAPTER] = "display",
+};
+
+/* Set by --image to operate on a regular file instead of nv_devs[] */
+static struct non_volatile_device image_dev = { .mmap = 1 };
+
+/*
+ * A device handle keeps the underlying file descriptor open for the whole
+ * invocation, so probing, reading and writing a config block only cost one
+ * open() and all accesses are done with pread()/pwrite() at the device
+ * offset. Image files are mapped instead: only the pages holding the config
+ * block are mapped, so the size of the image doesn't matter, and the block
+ * is parsed straight from the mapping.
+ */
+struct nv_handle {
+	const struct non_volatile_device *dev;
+	int fd;
+	size_t size;
+	u8 *map;
+	void *map_base;
+	size_t map_len;
+	int writable;
+	/* A file standing in for a board device, see nv_fake */
+	int fake;
+};
 
-static const char * const get_toradex_carrier_boards(int pid4)
+static size_t nv_block_size(const struct non_volatile_device *nv_dev)
 {
-	int i, index = 0;
+	if (nv_dev->size)
+		return nv_dev->size;
 
-	for (i = 1; i < ARRAY_SIZE(toradex_carrier_boards); i++) {
-		if (pid4 == toradex_carrier_boards[i].pid4) {
-			index = i;
-			break;
-		}
-	}
-	return toradex_carrier_boards[index].name;
+	return nv_dev->type == TDX_EEPROM_ID_MODULE ?
+		TDX_CFG_BLOCK_MAX_SIZE : TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
 }
 
-static const char * const get_toradex_display_adapters(int pid4)
+/* Device I/O counters, reported by --stats */
+struct nv_stats {
+	unsigned long opens;
+	unsigned long reads;
+	unsigned long bytes_read;
+	unsigned long writes;
+	unsigned long bytes_written;
+	unsigned long syscalls;
+};
+
+static struct nv_stats nv_stats;
+
+/*
+ * With --stats, the time spent in every phase of a command is summed up
+ * from the monotonic clock, and every device open, i.e. every candidate
+ * probed by first_valid_nv_dev(), is recorded with its outcome. Without it
+ * nothing is timed.
+ */
+enum {
+	STATS_OFF,
+	STATS_TEXT,
+	STATS_JSON,
+};
+
+static int stats_mode;
+
+enum {
+	PHASE_DISCOVER,
+	PHASE_PROBE,
+	PHASE_OPEN,
+	PHASE_CACHE,
+	PHASE_READ,
+	PHASE_WRITE,
+	PHASE_PARSE,
+	PHASE_FORMAT,
+	PHASE_COUNT,
+};
+
+static const char * const phase_name[PHASE_COUNT] = {
+	[PHASE_DISCOVER] = "discover",
+	[PHASE_PROBE] = "probe",
+	[PHASE_OPEN] = "open",
+	[PHASE_CACHE] = "cache",
+	[PHASE_READ] = "read",
+	[PHASE_WRITE] = "write",
+	[PHASE_PARSE] = "parse",
+	[PHASE_FORMAT] = "format",
+};
+
+static struct {
+	unsigned long calls;
+	uint64_t ns;
+} phase_stats[PHASE_COUNT];
+
+#define TDX_STATS_PROBES_MAX	16
+
+static struct {
+	char path[128];
+	int type;
+	int ret;
+	uint64_t ns;
+} probe_stats[TDX_STATS_PROBES_MAX];
+
+static unsigned int probe_count;
+
+static void stats_start(struct timespec *start)
 {
-	int i, index = 0;
+	if (stats_mode)
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
 
-	for (i = 1; i < ARRAY_SIZE(toradex_display_adapters); i++) {
-		if (pid4 == toradex_display_adapters[i].pid4) {
-			index = i;
-			break;
-		}
+/* Time since start, added to the phase with --stats */
+static uint64_t stats_elapsed(int phase, const struct timespec *start)
+{
+	struct timespec now;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (now.tv_sec - start->tv_sec) * 1000000000ULL +
+	     now.tv_nsec - start->tv_nsec;
+	if (stats_mode) {
+		__atomic_fetch_add(&phase_stats[phase].calls, 1,
+				   __ATOMIC_RELAXED);
+		__atomic_fetch_add(&phase_stats[phase].ns, ns,
+				   __ATOMIC_RELAXED);
 	}
-	return toradex_display_adapters[index].name;
+
+	return ns;
 }
 
-static u32 get_serial_from_mac(struct toradex_eth_addr *eth_addr)
+static uint64_t stats_stop(int phase, const struct timespec *start)
 {
-	int i;
-	u32 oui = ntohl(eth_addr->oui) >> 8;
-	u32 nic = ntohl(eth_addr->nic) >> 8;
+	return stats_mode ? stats_elapsed(phase, start) : 0;
+}
 
-	for (i = 0; i < ARRAY_SIZE(toradex_ouis); i++) {
-		if (toradex_ouis[i] == oui)
-			break;
-	}
+static void stats_probe(const char *path, int type, int ret, uint64_t ns)
+{
+	unsigned int i;
+
+	if (!stats_mode)
+		return;
+
+	i = __atomic_fetch_add(&probe_count, 1, __ATOMIC_RELAXED);
+	if (i >= TDX_STATS_PROBES_MAX)
+		return;
 
-	return (u32)((i << 24) + nic);
+	snprintf(probe_stats[i].path, sizeof(probe_stats[i].path), "%s", path);
+	probe_stats[i].type = type;
+	probe_stats[i].ret = ret;
+	probe_stats[i].ns = ns;
 }
 
-void get_mac_from_serial(u32 tdx_serial, struct toradex_eth_addr *eth_addr)
+static void nv_syscall(void)
 {
-	u8 oui_index = tdx_serial >> 24;
-	u32 nic = tdx_serial & GENMASK(23, 0);
-	u32 oui;
+	__atomic_fetch_add(&nv_stats.syscalls, 1, __ATOMIC_RELAXED);
+}
+
+#ifdef CONFIG_TDX_CFG_BLOCK_FAKE_DEV
+/*
+ * Benchmark builds (make bench) let plain files stand in for the board
+ * devices. TDX_CFGBLOCK_SYSROOT is put in front of the absolute device paths,
+ * including the sysfs directories and the config file used to find the
+ * devices, and TDX_CFGBLOCK_FAKE_LATENCY, e.g. "read_us=100,page_us=5000,page=16",
+ * makes accesses to those files as slow as an I2C EEPROM: read_us per byte
+ * read and page_us per `page` byte write page touched.
+ */
+static struct {
+	const char *sysroot;
+	unsigned long read_us;
+	unsigned long page_us;
+	unsigned long page;
+} nv_fake = { .page = 16 };
+
+static int nv_fake_init(void)
+{
+	static const char * const keys[] = { "read_us", "page_us", "page" };
+	unsigned long *values[] = { &nv_fake.read_us, &nv_fake.page_us,
+				    &nv_fake.page };
+	const char *latency = getenv("TDX_CFGBLOCK_FAKE_LATENCY");
+	const char *p = latency;
+	char *end;
+
+	nv_fake.sysroot = getenv("TDX_CFGBLOCK_SYSROOT");
+
+	while (p && *p) {
+		size_t len = strcspn(p, "=");
+		int k;
+
+		for (k = 0; k < ARRAY_SIZE(keys); k++) {
+			if (strlen(keys[k]) == len && !strncmp(p, keys[k], len))
+				break;
+		}
+		if (k == ARRAY_SIZE(keys) || p[len] != '=')
+			goto invalid;
 
-	if (oui_index >= ARRAY_SIZE(toradex_ouis)) {
-		puts("Can't find OUI for this serial#\n");
-		oui_index = 0;
+		*values[k] = strtoul(p + len + 1, &end, 0);
+		if (end == p + len + 1 || (*end && *end != ','))
+			goto invalid;
+		p = *end ? end + 1 : end;
 	}
 
-	oui = toradex_ouis[oui_index];
+	if (!nv_fake.page)
+		goto invalid;
+
+	return 0;
 
-	eth_addr->oui = htonl(oui << 8);
-	eth_addr->nic = htonl(nic << 8);
+invalid:
+	printf("error: invalid TDX_CFGBLOCK_FAKE_LATENCY '%s'.\n", latency);
+	return -EINVAL;
 }
 
-struct non_volatile_device {
-	int type;
-	const char* path;
-	int offset;
-};
+/* The file standing in for path, path itself if there is none */
+static const char *nv_fake_path(const char *path, char *buf, size_t size)
+{
+	if (!nv_fake.sysroot || path[0] != '/')
+		return path;
 
-const struct non_volatile_device nv_devs[] = {
-	{TDX_EEPROM_ID_MODULE, "/dev/mmcblk2boot0", 0x3ffe00},
-	{TDX_EEPROM_ID_CARRIER, "/sys/bus/nvmem/devices/3-00573/nvmem", 0},
-	{TDX_EEPROM_ID_CARRIER, "/sys/bus/nvmem/devices/3-00513/nvmem", 0},
-};
+	snprintf(buf, size, "%s%s", nv_fake.sysroot, path);
+	return buf;
+}
 
-static const struct non_volatile_device* first_valid_nv_dev(u32 type)
+/* How long the device would take for the access */
+static unsigned long nv_fake_us(off_t pos, int size, int write)
 {
-	int fd;
+	if (size <= 0)
+		return 0;
 
-	for (int i=0; i<ARRAY_SIZE(nv_devs); ++i) {
-		const struct non_volatile_device* nv_dev = &nv_devs[i];
-		if (nv_dev->type == type) {
-			fd = open(nv_dev->path, O_RDONLY);
-			if (fd != -1) {
-				close(fd);
-				return nv_dev;
-			}
-		}
-	}
+	if (write)
+		return ((pos + size - 1) / nv_fake.page - pos / nv_fake.page +
+			1) * nv_fake.page_us;
+
+	return size * nv_fake.read_us;
 }
 
-static int read_nv_device_data(const struct non_volatile_device* nv_dev,
-	int offset, uint8_t *buf, int size)
+static void nv_fake_delay(struct nv_handle *h, off_t pos, int size, int write)
 {
-	int fd;
+	unsigned long us;
+	struct timespec ts;
 
-	fd = open(nv_dev->path, O_RDONLY);
-	if (fd == -1) {
-		printf("error: cannot open '%s'.\n", nv_dev->path);
-		return -1;
-	}
+	if (!h->fake)
+		return;
 
-	offset += nv_dev->offset;
+	us = nv_fake_us(pos, size, write);
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = us % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+#else
+static inline int nv_fake_init(void) { return 0; }
+static inline const char *nv_fake_path(const char *path, char *buf,
+	size_t size) { return path; }
+static inline unsigned long nv_fake_us(off_t pos, int size, int write)
+{ return 0; }
+static inline void nv_fake_delay(struct nv_handle *h, off_t pos, int size,
+	int write) { }
+#endif
 
-	if (lseek(fd, offset, SEEK_SET) == -1) {
-		printf("error: cannot seek to %i.\n", offset);
-		close(fd);
-		return -1;
+static int nv_map(struct nv_handle *h)
+{
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t start = h->dev->offset & ~(page - 1);
+	off_t end = h->dev->offset + h->size;
+	struct stat st;
+
+	nv_syscall();
+	if (fstat(h->fd, &st))
+		return -errno;
+
+	/* Grow images that are too short to hold the block when writing */
+	if (st.st_size < end) {
+		if (h->writable)
+			nv_syscall();
+		if (!h->writable || ftruncate(h->fd, end)) {
+			printf("error: '%s' is too small for a config block at %lld.\n",
+			       h->dev->path, (long long)h->dev->offset);
+			return -EINVAL;
+		}
 	}
 
-	if (read(fd, buf, size) != size) {
-		printf("error: could not read %i bytes.\n", size);
-		close(fd);
-		return -1;
+	h->map_len = end - start;
+	nv_syscall();
+	h->map_base = mmap(NULL, h->map_len,
+			   PROT_READ | (h->writable ? PROT_WRITE : 0),
+			   MAP_SHARED, h->fd, start);
+	if (h->map_base == MAP_FAILED) {
+		h->map_base = NULL;
+		return -errno;
 	}
+	h->map = (u8 *)h->map_base + (h->dev->offset - start);
 
-	close(fd);
 	return 0;
 }
 
-static int write_nv_device_data(const struct non_volatile_device* nv_dev,
-	int offset, uint8_t *buf, int size)
+static void nv_close(struct nv_handle *h)
 {
-	int fd;
+	if (h->map_base) {
+		if (h->writable) {
+			nv_syscall();
+			msync(h->map_base, h->map_len, MS_SYNC);
+		}
+		nv_syscall();
+		munmap(h->map_base, h->map_len);
+		h->map_base = NULL;
+		h->map = NULL;
+	}
 
-	fd = open(nv_dev->path, O_RDWR);
-	if (fd == -1) {
-		printf("error: cannot open '%s'.\n", nv_dev->path);
-		return -1;
+	if (h->fd != -1) {
+		nv_syscall();
+		close(h->fd);
 	}
+	h->fd = -1;
+}
+
+static int nv_open(struct nv_handle *h, const struct non_volatile_device *nv_dev,
+	int flags)
+{
+	const char *path = nv_dev->path;
+	char fake_path[PATH_MAX];
+	struct timespec start;
+	int ret = 0;
 
-	offset += nv_dev->offset;
+	memset(h, 0, sizeof(*h));
+	h->dev = nv_dev;
+	h->size = nv_block_size(nv_dev);
+	h->writable = (flags & O_ACCMODE) != O_RDONLY;
+	if (nv_dev != &image_dev)
+		path = nv_fake_path(path, fake_path, sizeof(fake_path));
+	h->fake = path != nv_dev->path;
+	stats_start(&start);
+	__atomic_fetch_add(&nv_stats.opens, 1, __ATOMIC_RELAXED);
+	nv_syscall();
+	h->fd = open(path, flags, 0644);
+	if (h->fd == -1)
+		ret = -errno;
+	else if (nv_dev->mmap)
+		ret = nv_map(h);
+	if (ret)
+		nv_close(h);
 
-	if (lseek(fd, offset, SEEK_SET) == -1) {
-		printf("error: cannot seek to %i.\n", offset);
-		close(fd);
-		return -1;
+	stats_probe(nv_dev->path, nv_dev->type, ret,
+		    stats_stop(PHASE_OPEN, &start));
+
+	return ret;
+}
+
+/*
+ * Device accesses fire the read_start/read_done and write_start/write_done
+ * tracepoints with the device path, offset and size; the done probes add
+ * the result and the duration in ns.
+ */
+TDX_TRACE_SEMAPHORE(read_start);
+TDX_TRACE_SEMAPHORE(read_done);
+TDX_TRACE_SEMAPHORE(write_start);
+TDX_TRACE_SEMAPHORE(write_done);
+
+static int read_nv_device_data(struct nv_handle *h, int offset, uint8_t *buf,
+	int size)
+{
+	off_t pos = h->dev->offset + offset;
+	int timed = stats_mode || TDX_TRACE_ENABLED(read_done);
+	struct timespec start;
+	uint64_t ns = 0;
+	int ret = 0;
+
+	TDX_TRACE3(read_start, h->dev->path, (long long)pos, size);
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+	__atomic_fetch_add(&nv_stats.reads, 1, __ATOMIC_RELAXED);
+	if (h->map) {
+		if (offset < 0 || offset + size > h->size)
+			ret = -1;
+		else
+			memcpy(buf, h->map + offset, size);
+	} else {
+		nv_syscall();
+		if (pread(h->fd, buf, size, pos) != size)
+			ret = -1;
 	}
 
-	if (write(fd, buf, size) != size) {
-		printf("error: could not write %i bytes.\n", size);
-		close(fd);
-		return -1;
+	if (!ret) {
+		nv_fake_delay(h, pos, size, 0);
+		__atomic_fetch_add(&nv_stats.bytes_read, size,
+				   __ATOMIC_RELAXED);
 	}
 
-	close(fd);
-	return 0;
+	if (timed)
+		ns = stats_elapsed(PHASE_READ, &start);
+	TDX_TRACE5(read_done, h->dev->path, (long long)pos, size, ret, ns);
+
+	if (ret)
+		printf("error: could not read %i bytes at %lld.\n", size,
+		       (long long)pos);
+
+	return ret;
 }
 
-static int read_tdx_cfg_block(const struct non_volatile_device* nv_dev,
-	struct tdx_data* data)
+static int write_nv_device_data(struct nv_handle *h, int offset, uint8_t *buf,
+	int size)
 {
+	off_t pos = h->dev->offset + offset;
+	int timed = stats_mode || TDX_TRACE_ENABLED(write_done);
+	struct timespec start;
+	uint64_t ns = 0;
 	int ret = 0;
-	u8 *config_block = NULL;
-	struct toradex_tag *tag;
-	size_t size = TDX_CFG_BLOCK_MAX_SIZE;
-	int offset;
-
-	/* Allocate RAM area for config block */
-	config_block = memalign(ARCH_DMA_MINALIGN, size);
-	if (!config_block) {
-		printf("Not enough malloc space available!\n");
-		return -ENOMEM;
+
+	TDX_TRACE3(write_start, h->dev->path, (long long)pos, size);
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+	__atomic_fetch_add(&nv_stats.writes, 1, __ATOMIC_RELAXED);
+	if (h->map) {
+		if (!h->writable || offset < 0 || offset + size > h->size)
+			ret = -1;
+		else
+			memcpy(h->map + offset, buf, size);
+	} else {
+		nv_syscall();
+		if (pwrite(h->fd, buf, size, pos) != size)
+			ret = -1;
 	}
 
-	memset(config_block, 0, size);
+	if (!ret) {
+		nv_fake_delay(h, pos, size, 1);
+		__atomic_fetch_add(&nv_stats.bytes_written, size,
+				   __ATOMIC_RELAXED);
+	}
+
+	if (timed)
+		ns = stats_elapsed(PHASE_WRITE, &start);
+	TDX_TRACE5(write_done, h->dev->path, (long long)pos, size, ret, ns);
 
-	ret = read_nv_device_data(nv_dev, 0x0, config_block,
-				    TDX_CFG_BLOCK_MAX_SIZE);
 	if (ret)
-		goto out;
+		printf("error: could not write %i bytes at %lld.\n", size,
+		       (long long)pos);
 
-	/* Expect a valid tag first */
-	tag = (struct toradex_tag *)config_block;
-	if (tag->flags != TAG_FLAG_VALID || tag->id != TAG_VALID) {
-		ret = -EINVAL;
-		goto out;
-	}
-	offset = 4;
+	return ret;
+}
 
-	/*
-	 * check if there is enough space for storing tag and value of the
-	 * biggest element
-	 */
-	while (offset + sizeof(struct toradex_tag) +
-	       sizeof(struct toradex_hw) < TDX_CFG_BLOCK_MAX_SIZE) {
-		tag = (struct toradex_tag *)(config_block + offset);
-		offset += 4;
-		if (tag->id == TAG_INVALID)
+static int parse_tdx_cfg_block_timed(const u8 *config_block, size_t avail,
+	size_t size, u32 want, struct tdx_data *data, size_t *need)
+{
+	struct timespec start;
+	int ret;
+
+	stats_start(&start);
+	ret = tdx_parse_cfg_block(config_block, avail, size, want, data, need);
+	stats_stop(PHASE_PARSE, &start);
+
+	return ret;
+}
+
+/*
+ * Read a config block header first and then only as much of the TLV chain as
+ * is needed to decode the tags selected by `want`. A blank or invalid device
+ * costs a 4 byte read instead of a full block. On return *avail holds how
+ * many leading bytes of config_block were fetched.
+ */
+static int fetch_tdx_cfg_block(struct nv_handle *h, u8 *config_block,
+	size_t size, u32 want, struct tdx_data *data, size_t *avail)
+{
+	size_t need = 0;
+	int ret;
+
+	*avail = 0;
+	memset(config_block, 0, size);
+
+	while ((ret = parse_tdx_cfg_block_timed(config_block, *avail, size,
+						want, data, &need)) == -EAGAIN) {
+		if (need > size)
+			need = size;
+
+		if (need <= *avail) {
+			/* Ran off the end of the block */
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = read_nv_device_data(h, *avail, config_block + *avail,
+					  need - *avail);
+		if (ret)
 			break;
+		*avail = need;
+	}
 
-		if (tag->flags == TAG_FLAG_VALID) {
-			switch (tag->id) {
-			case TAG_MAC:
-				memcpy(&data->eth_addr, config_block + offset,
-				       6);
+	return ret;
+}
 
-				data->serial = get_serial_from_mac(&data->eth_addr);
-				break;
-			case TAG_HW:
-				memcpy(&data->hw_tag, config_block + offset, 8);
-				break;
-			}
+static int read_tdx_cfg_block_tags(struct nv_handle *h, u32 want,
+	struct tdx_data *data)
+{
+	u8 config_block[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	size_t size = h->size;
+	size_t avail;
+
+	/* Mapped images are parsed in place */
+	if (h->map)
+		return parse_tdx_cfg_block_timed(h->map, size, size, want,
+						 data, &avail);
+
+	if (size > sizeof(config_block))
+		return -EINVAL;
+
+	return fetch_tdx_cfg_block(h, config_block, size, want, data, &avail);
+}
+
+/*
+ * EEPROMs are programmed a page at a time and every page write costs a write
+ * cycle of a few milliseconds, so config block updates only touch the pages
+ * whose content actually changes. The page size can be set with
+ * --page-size; alignment is relative to the start of the device.
+ */
+#define TDX_CFG_PAGE_SIZE_DEFAULT	16
+
+static int nv_page_size = TDX_CFG_PAGE_SIZE_DEFAULT;
+
+struct nv_write_report {
+	int pages;
+	int pages_total;
+	double msecs;
+};
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 +
+	       (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Write buf at offset, skipping pages that already hold the same bytes.
+ * Consecutive dirty pages are merged into a single pwrite(). The current
+ * device content is read back unless the caller already has it in `old`. If
+ * it can't be read, everything is written.
+ */
+static int write_nv_device_data_diff(struct nv_handle *h, int offset,
+	uint8_t *buf, int size, const uint8_t *old,
+	struct nv_write_report *report)
+{
+	struct timespec start;
+	u8 current[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	int pos, end, dirty, run = -1, ret = 0;
+	off_t base = h->dev->offset;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(report, 0, sizeof(*report));
+
+	if (size > sizeof(current))
+		return -EINVAL;
+
+	/* Make every page look dirty when the old content is unknown */
+	if (old)
+		memcpy(current, old, size);
+	else if (read_nv_device_data(h, offset, current, size))
+		for (pos = 0; pos < size; pos++)
+			current[pos] = ~buf[pos];
+
+	for (pos = 0; pos < size; pos = end) {
+		off_t page_end = ((base + offset + pos) / nv_page_size + 1) *
+				 nv_page_size;
+
+		end = page_end - base - offset;
+		if (end > size)
+			end = size;
+
+		report->pages_total++;
+		dirty = memcmp(current + pos, buf + pos, end - pos) != 0;
+		if (dirty) {
+			report->pages++;
+			if (run == -1)
+				run = pos;
 		}
 
-		/* Get to next tag according to current tags length */
-		offset += tag->len * 4;
+		/* Flush the pending run at the first clean page or at the end */
+		if (run != -1 && (!dirty || end == size)) {
+			ret = write_nv_device_data(h, offset + run, buf + run,
+						   (dirty ? end : pos) - run);
+			if (ret)
+				break;
+			run = -1;
+		}
 	}
 
-	/* Cap product id to avoid issues with a yet unknown one */
-	if (data->hw_tag.prodid >= ARRAY_SIZE(toradex_modules))
-		data->hw_tag.prodid = 0;
+	report->msecs = elapsed_ms(&start);
 
-out:
-	free(config_block);
 	return ret;
 }
 
+static int read_tdx_cfg_block(struct nv_handle *h, struct tdx_data* data)
+{
+	return read_tdx_cfg_block_tags(h, TDX_WANT_MODULE, data);
+}
+
 static int parse_assembly_string(char *string_to_parse, u16 *assembly)
 {
 	if (string_to_parse[3] >= 'A' && string_to_parse[3] <= 'Z')
@@ -365,16 +738,15 @@ static int get_cfgblock_interactive(struct tdx_data* data)
 	int i;
 
 	printf("Enabled modules:\n");
-	for (i = 0; i < ARRAY_SIZE(toradex_modules); i++) {
-		if (toradex_modules[i].is_enabled)
-			printf(" %04d %s\n", i, toradex_modules[i].name);
-	}
+	for (i = 0; i < toradex_modules_enabled_count; i++)
+		printf(" %04d %s\n", toradex_modules_enabled[i],
+		       toradex_modules[toradex_modules_enabled[i]].name);
 
 	sprintf(message, "Enter the module ID: ");
 	len = cli_readline(message);
 
 	prodid = dectoul(console_buffer, NULL);
-	if (prodid >= ARRAY_SIZE(toradex_modules) || !toradex_modules[prodid].is_enabled) {
+	if (prodid >= toradex_modules_count || !toradex_modules[prodid].is_enabled) {
 		printf("Parsing module id failed\n");
 		return -1;
 	}
@@ -405,113 +777,263 @@ static int get_cfgblock_interactive(struct tdx_data* data)
 	return 0;
 }
 
-static int get_cfgblock_barcode(char *barcode, struct toradex_hw *tag,
-				u32 *serial)
+/* Decode a barcode for a block of `type`, refusing what won't be valid */
+static int get_cfgblock_barcode(u32 type, const char *barcode,
+				struct toradex_hw *tag, u32 *serial)
 {
-	char revision[3] = {barcode[6], barcode[7], '\0'};
+	int err = tdx_barcode_decode(barcode, strlen(barcode), tag, serial);
 
-	if (strlen(barcode) < 16) {
-		printf("Argument too short, barcode is 16 chars long\n");
+	if (!err)
+		err = tdx_barcode_check(type, tag, *serial);
+	if (err) {
+		printf("Invalid barcode '%s': %s\n", barcode,
+		       tdx_barcode_error[err]);
 		return -1;
 	}
 
-	/* Get hardware information from the first 8 digits */
-	tag->ver_major = barcode[4] - '0';
-	tag->ver_minor = barcode[5] - '0';
-	tag->ver_assembly = dectoul(revision, NULL);
+	return 0;
+}
+
+int read_tdx_cfg_block_carrier(struct nv_handle *h, struct tdx_data* data)
+{
+	return read_tdx_cfg_block_tags(h, TDX_WANT_CARRIER, data);
+}
+
+static int read_tdx_data(struct nv_handle *h, u32 want, struct tdx_data *data)
+{
+	return read_tdx_cfg_block_tags(h, want, data);
+}
+
+/* Tags needed to print a single field, 0 if the name is unknown */
+static u32 tdx_field_want(u32 type, const char *name)
+{
+	size_t len = strlen(nv_dev_type_name[type]);
+	int module = type == TDX_EEPROM_ID_MODULE;
+
+	if (strncmp(name, nv_dev_type_name[type], len) || name[len] != '_')
+		return 0;
+	name += len + 1;
 
-	barcode[4] = '\0';
-	tag->prodid = dectoul(barcode, NULL);
+	if (!strcmp(name, "serial"))
+		return module ? TDX_WANT_MAC : TDX_WANT_CAR_SERIAL;
 
-	/* Parse second part of the barcode (serial number */
-	barcode += 8;
-	*serial = dectoul(barcode, NULL);
+	if (!strcmp(name, "prodid") || !strcmp(name, "prodname") ||
+	    !strcmp(name, "rev"))
+		return module ? TDX_WANT_HW : TDX_WANT_CAR_HW;
 
 	return 0;
 }
 
-static int write_tag(u8 *config_block, int *offset, int tag_id,
-		     u8 *tag_data, size_t tag_data_size)
+/*
+ * Parsed config blocks are cached in tmpfs so that repeated prints do not
+ * touch the bus. An entry is keyed on the device identity (path, device and
+ * inode numbers, offset and block type) and is dropped both before and after
+ * this tool writes to the device, so a print that runs during the write can't
+ * leave the old content cached. Hit and miss counters are shared between all
+ * invocations through a small mmap()ed file in the same directory.
+ */
+#define TDX_CFG_CACHE_DIR	"/run/tdx-cfgblock"
+#define TDX_CFG_CACHE_STATS	TDX_CFG_CACHE_DIR "/cache-stats"
+#define TDX_CFG_CACHE_MAGIC	0x43584454 /* "TDXC" */
+#define TDX_CFG_CACHE_VERSION	2
+
+static int use_cache = 1;
+/* Read the devices even on a cache hit and store what was read */
+static int cache_refresh;
+
+struct cfg_cache_entry {
+	u32 magic;
+	u32 version;
+	u32 type;
+	u32 reserved;
+	u64 offset;
+	u64 st_dev;
+	u64 st_ino;
+	u64 st_rdev;
+	char path[256];
+	struct tdx_data data;
+};
+
+struct cfg_cache_stats {
+	u64 hits;
+	u64 misses;
+};
+
+static int cfg_cache_key(struct nv_handle *h, struct cfg_cache_entry *entry,
+	char *name, size_t name_size)
 {
-	struct toradex_tag *tag;
+	struct stat st;
 
-	if (!offset || !config_block)
+	if (fstat(h->fd, &st) || strlen(h->dev->path) >= sizeof(entry->path))
 		return -EINVAL;
 
-	tag = (struct toradex_tag *)(config_block + *offset);
-	tag->id = tag_id;
-	tag->flags = TAG_FLAG_VALID;
-	/* len is provided as number of 32bit values after the tag */
-	tag->len = (tag_data_size + sizeof(u32) - 1) / sizeof(u32);
-	*offset += sizeof(struct toradex_tag);
-	if (tag_data && tag_data_size) {
-		memcpy(config_block + *offset, tag_data,
-		       tag_data_size);
-		*offset += tag_data_size;
-	}
+	memset(entry, 0, sizeof(*entry));
+	entry->magic = TDX_CFG_CACHE_MAGIC;
+	entry->version = TDX_CFG_CACHE_VERSION;
+	entry->type = h->dev->type;
+	entry->offset = h->dev->offset;
+	entry->st_dev = st.st_dev;
+	entry->st_ino = st.st_ino;
+	entry->st_rdev = st.st_rdev;
+	strcpy(entry->path, h->dev->path);
+
+	snprintf(name, name_size, "%s/%llx-%llx-%llx-%llx-%u", TDX_CFG_CACHE_DIR,
+		 (unsigned long long)entry->st_dev,
+		 (unsigned long long)entry->st_ino,
+		 (unsigned long long)entry->st_rdev,
+		 (unsigned long long)entry->offset, entry->type);
 
 	return 0;
 }
 
-int read_tdx_cfg_block_carrier(const struct non_volatile_device* nv_dev,
-	struct tdx_data* data)
+static void cfg_cache_count(int hit)
 {
-	int ret = 0;
-	u8 *config_block = NULL;
-	struct toradex_tag *tag;
-	size_t size = TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
-	int offset;
-
-	/* Allocate RAM area for carrier config block */
-	config_block = memalign(ARCH_DMA_MINALIGN, size);
-	if (!config_block) {
-		printf("Not enough malloc space available!\n");
-		return -ENOMEM;
+	struct cfg_cache_stats *stats;
+	int fd;
+
+	fd = open(TDX_CFG_CACHE_STATS, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+		return;
+
+	if (ftruncate(fd, sizeof(*stats)) == 0) {
+		stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+			     MAP_SHARED, fd, 0);
+		if (stats != MAP_FAILED) {
+			__atomic_fetch_add(hit ? &stats->hits : &stats->misses,
+					   1, __ATOMIC_RELAXED);
+			munmap(stats, sizeof(*stats));
+		}
 	}
 
-	memset(config_block, 0, size);
+	close(fd);
+}
 
-	ret = read_nv_device_data(nv_dev, 0x0, config_block,
-				   size);
-	if (ret)
-		return ret;
+static int cfg_cache_lookup(struct nv_handle *h, struct tdx_data *data)
+{
+	struct cfg_cache_entry key, entry;
+	char name[PATH_MAX];
+	int fd, ret = -ENOENT;
 
-	/* Expect a valid tag first */
-	tag = (struct toradex_tag *)config_block;
-	if (tag->flags != TAG_FLAG_VALID || tag->id != TAG_VALID) {
-		ret = -EINVAL;
-		goto out;
+	if (cfg_cache_key(h, &key, name, sizeof(name)))
+		return -EINVAL;
+
+	fd = open(name, O_RDONLY);
+	if (fd != -1) {
+		if (read(fd, &entry, sizeof(entry)) == sizeof(entry) &&
+		    !memcmp(&entry, &key, offsetof(struct cfg_cache_entry, data))) {
+			memcpy(data, &entry.data, sizeof(*data));
+			ret = 0;
+		}
+		close(fd);
 	}
-	offset = 4;
 
-	while (offset + sizeof(struct toradex_tag) +
-	       sizeof(struct toradex_hw) < TDX_CFG_BLOCK_MAX_SIZE) {
-		tag = (struct toradex_tag *)(config_block + offset);
-		offset += 4;
-		if (tag->id == TAG_INVALID)
-			break;
+	cfg_cache_count(ret == 0);
 
-		if (tag->flags == TAG_FLAG_VALID) {
-			switch (tag->id) {
-			case TAG_CAR_SERIAL:
-				memcpy(&data->car_serial, config_block + offset,
-				       sizeof(data->car_serial));
-				break;
-			case TAG_HW:
-				memcpy(&data->car_hw_tag, config_block +
-				       offset, 8);
-				break;
-			}
-		}
+	return ret;
+}
+
+static void cfg_cache_store(struct nv_handle *h, const struct tdx_data *data)
+{
+	struct cfg_cache_entry entry;
+	char name[PATH_MAX];
+	char tmp[PATH_MAX];
+	int fd;
+
+	if (cfg_cache_key(h, &entry, name, sizeof(name)))
+		return;
+
+	memcpy(&entry.data, data, sizeof(*data));
+
+	mkdir(TDX_CFG_CACHE_DIR, 0755);
+	snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", TDX_CFG_CACHE_DIR);
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return;
+
+	/* Publish the entry atomically so readers never see a partial one */
+	if (write(fd, &entry, sizeof(entry)) != sizeof(entry) ||
+	    fchmod(fd, 0644) || rename(tmp, name))
+		unlink(tmp);
+
+	close(fd);
+}
+
+static void cfg_cache_invalidate(struct nv_handle *h)
+{
+	struct cfg_cache_entry entry;
+	char name[PATH_MAX];
+
+	if (!cfg_cache_key(h, &entry, name, sizeof(name)))
+		unlink(name);
+}
+
+/*
+ * Get the tags selected by `want`, from the cache when possible. Only complete
+ * blocks are stored in the cache.
+ */
+static int load_tdx_data(struct nv_handle *h, u32 want, struct tdx_data *data)
+{
+	struct timespec start;
+	int ret;
+
+	if (use_cache && !cache_refresh) {
+		stats_start(&start);
+		ret = cfg_cache_lookup(h, data);
+		stats_stop(PHASE_CACHE, &start);
+		if (!ret)
+			return 0;
+	}
 
-		/* Get to next tag according to current tags length */
-		offset += tag->len * 4;
+	ret = read_tdx_data(h, want, data);
+	if (!ret && use_cache && want == tdx_data_want_all(h->dev->type)) {
+		stats_start(&start);
+		cfg_cache_store(h, data);
+		stats_stop(PHASE_CACHE, &start);
 	}
-out:
-	free(config_block);
+
 	return ret;
 }
 
+static int do_cfgblock_cache_stats(void)
+{
+	struct cfg_cache_stats stats = { 0 };
+	int fd;
+
+	fd = open(TDX_CFG_CACHE_STATS, O_RDONLY);
+	if (fd != -1) {
+		if (read(fd, &stats, sizeof(stats)) != sizeof(stats))
+			memset(&stats, 0, sizeof(stats));
+		close(fd);
+	}
+
+	printf("cache_hits=\"%llu\"\n"
+			"cache_misses=\"%llu\"\n",
+			(unsigned long long)stats.hits,
+			(unsigned long long)stats.misses);
+
+	return CMD_RET_SUCCESS;
+}
+
+static int do_cfgblock_cache_clear(void)
+{
+	DIR *dir;
+	struct dirent *de;
+
+	dir = opendir(TDX_CFG_CACHE_DIR);
+	if (!dir)
+		return CMD_RET_SUCCESS;
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.' && (!de->d_name[1] ||
+		    (de->d_name[1] == '.' && !de->d_name[2])))
+			continue;
+		unlinkat(dirfd(dir), de->d_name, 0);
+	}
+	closedir(dir);
+
+	return CMD_RET_SUCCESS;
+}
+
 static int get_cfgblock_carrier_interactive(struct tdx_data* data)
 {
 	char message[CONFIG_SYS_CBSIZE];
@@ -520,7 +1042,7 @@ static int get_cfgblock_carrier_interactive(struct tdx_data* data)
 
 	printf("Supported carrier boards:\n");
 	printf("%30s\t[ID]\n", "CARRIER BOARD NAME");
-	for (int i = 0; i < ARRAY_SIZE(toradex_carrier_boards); i++)
+	for (int i = 0; i < toradex_carrier_boards_count; i++)
 		printf("%30s\t[%d]\n",
 		       toradex_carrier_boards[i].name,
 		       toradex_carrier_boards[i].pid4);
@@ -553,96 +1075,93 @@ static int get_cfgblock_carrier_interactive(struct tdx_data* data)
 	return 0;
 }
 
-static int do_cfgblock_carrier_create(const struct non_volatile_device* nv_dev,
-	int force_overwrite, char *barcode)
+/*
+ * Encode a fresh config block for the device type of h from data and write
+ * it, touching only the pages that change.
+ */
+static int write_tdx_data(struct nv_handle *h, struct tdx_data *data,
+	struct nv_write_report *report)
+{
+	int module = h->dev->type == TDX_EEPROM_ID_MODULE;
+	u8 config_block[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	size_t size = h->size;
+	int ret;
+
+	if (size > sizeof(config_block))
+		return -EINVAL;
+
+	if (!module)
+		ret = tdx_encode_cfg_block_carrier(config_block, size, data);
+	else
+		ret = tdx_encode_cfg_block(config_block, size, data);
+	if (ret == -ERANGE)
+		printf("Can't find OUI for this serial#\n");
+	else if (ret)
+		return ret;
+
+	cfg_cache_invalidate(h);
+	ret = write_nv_device_data_diff(h, 0x0, config_block, size, NULL,
+					report);
+	cfg_cache_invalidate(h);
+
+	return ret;
+}
+
+static int do_cfgblock_carrier_create(struct nv_handle *h, int force_overwrite, char *barcode)
 {
 	struct tdx_data data;
-	u8 *config_block;
-	size_t size = TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
-	int offset = 0;
-	int ret = CMD_RET_SUCCESS;
+	struct nv_write_report report;
 	int err;
 
-	/* Allocate RAM area for config block */
-	config_block = memalign(ARCH_DMA_MINALIGN, size);
-	if (!config_block) {
-		printf("Not enough malloc space available!\n");
-		return CMD_RET_FAILURE;
-	}
-
-	memset(config_block, 0xff, size);
-	err = read_tdx_cfg_block_carrier(nv_dev, &data);
+	err = read_tdx_cfg_block_carrier(h, &data);
 	if ((err == 0) && !force_overwrite) {
 		char message[CONFIG_SYS_CBSIZE];
 
 		sprintf(message, "A valid Toradex Carrier config block is present, still recreate? [y/N] ");
 
 		if (!cli_readline(message))
-			goto out;
+			return CMD_RET_SUCCESS;
 
 		if (console_buffer[0] != 'y' &&
 		    console_buffer[0] != 'Y')
-			goto out;
+			return CMD_RET_SUCCESS;
 	}
 
 	if (!barcode) {
 		err = get_cfgblock_carrier_interactive(&data);
 	} else {
-		err = get_cfgblock_barcode(barcode, &data.car_hw_tag, &data.car_serial);
-	}
-
-	if (err) {
-		ret = CMD_RET_FAILURE;
-		goto out;
+		err = get_cfgblock_barcode(h->dev->type, barcode,
+					   &data.car_hw_tag, &data.car_serial);
 	}
 
-	/* Valid Tag */
-	write_tag(config_block, &offset, TAG_VALID, NULL, 0);
-
-	/* Product Tag */
-	write_tag(config_block, &offset, TAG_HW, (u8 *)&data.car_hw_tag,
-		  sizeof(data.car_hw_tag));
-
-	/* Serial Tag */
-	write_tag(config_block, &offset, TAG_CAR_SERIAL, (u8 *)&data.car_serial,
-		  sizeof(data.car_serial));
+	if (err)
+		return CMD_RET_FAILURE;
 
-	memset(config_block + offset, 0, 32 - offset);
-	err = write_nv_device_data(nv_dev, 0x0, config_block, size);
+	err = write_tdx_data(h, &data, &report);
 	if (err) {
 		printf("Failed to write Toradex Extra config block: %d\n",
-		       ret);
-		ret = CMD_RET_FAILURE;
-		goto out;
+		       err);
+		return CMD_RET_FAILURE;
 	}
 
-	printf("Toradex Extra config block successfully written\n");
+	if (!report.pages)
+		printf("Toradex Extra config block unchanged, nothing written (%.1f ms)\n",
+		       report.msecs);
+	else
+		printf("Toradex Extra config block successfully written (%d/%d pages, %.1f ms)\n",
+		       report.pages, report.pages_total, report.msecs);
 
-out:
-	free(config_block);
-	return ret;
+	return CMD_RET_SUCCESS;
 }
 
-static int do_cfgblock_create(const struct non_volatile_device* nv_dev,
-	int force_overwrite, char *barcode)
+static int do_cfgblock_create(struct nv_handle *h, int force_overwrite, char *barcode)
 {
 	struct tdx_data data;
-	u8 *config_block;
-	size_t size = TDX_CFG_BLOCK_MAX_SIZE;
-	int offset = 0;
+	struct nv_write_report report;
 	int ret = CMD_RET_SUCCESS;
 	int err;
 
-	/* Allocate RAM area for config block */
-	config_block = memalign(ARCH_DMA_MINALIGN, size);
-	if (!config_block) {
-		printf("Not enough malloc space available!\n");
-		return CMD_RET_FAILURE;
-	}
-
-	memset(config_block, 0xff, size);
-
-	err = read_tdx_cfg_block(nv_dev, &data);
+	err = read_tdx_cfg_block(h, &data);
 	if (err == 0) {
 #if defined(CONFIG_TDX_CFG_BLOCK_IS_IN_NAND)
 		/*
@@ -682,192 +1201,5980 @@ static int do_cfgblock_create(const struct non_volatile_device* nv_dev,
 	if (!barcode) {
 		err = get_cfgblock_interactive(&data);
 	} else {
-		err = get_cfgblock_barcode(barcode, &data.hw_tag, &data.serial);
+		err = get_cfgblock_barcode(TDX_EEPROM_ID_MODULE, barcode,
+					   &data.hw_tag, &data.serial);
 	}
 	if (err) {
 		ret = CMD_RET_FAILURE;
 		goto out;
 	}
 
-	/* Convert serial number to MAC address (the storage format) */
-	get_mac_from_serial(data.serial, &data.eth_addr);
-
-	/* Valid Tag */
-	write_tag(config_block, &offset, TAG_VALID, NULL, 0);
-
-	/* Product Tag */
-	write_tag(config_block, &offset, TAG_HW, (u8 *)&data.hw_tag,
-		  sizeof(data.hw_tag));
-
-	/* MAC Tag */
-	write_tag(config_block, &offset, TAG_MAC, (u8 *)&data.eth_addr,
-		  sizeof(data.eth_addr));
-
-	memset(config_block + offset, 0, 32 - offset);
-
-	err = write_nv_device_data(nv_dev, 0x0, config_block,
-				     TDX_CFG_BLOCK_MAX_SIZE);
+	err = write_tdx_data(h, &data, &report);
 	if (err) {
-		printf("Failed to write Toradex config block: %d\n", ret);
+		printf("Failed to write Toradex config block: %d\n", err);
 		ret = CMD_RET_FAILURE;
 		goto out;
 	}
 
-	printf("Toradex config block successfully written\n");
+	if (!report.pages)
+		printf("Toradex config block unchanged, nothing written (%.1f ms)\n",
+		       report.msecs);
+	else
+		printf("Toradex config block successfully written (%d/%d pages, %.1f ms)\n",
+		       report.pages, report.pages_total, report.msecs);
 
 out:
-	free(config_block);
 	return ret;
 }
 
-static int do_cfgblock_carrier_print(const struct non_volatile_device* nv_dev)
+static int tdx_type_from_name(const char *name)
 {
+	for (int type = 0; type < TDX_EEPROM_ID_COUNT; type++) {
+		if (!strcmp(name, nv_dev_type_name[type]))
+			return type;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Batched config block reads over many devices, for device discovery and
+ * print all. The sync backend opens and reads one device after the other.
+ * The io_uring backend submits the opens of a whole batch at once, then one
+ * read per device and round (the 4 byte header, then as much of the block
+ * as is still needed) and finally the closes, so a batch costs a handful of
+ * system calls and the devices are read concurrently by the kernel. It is used unless --io sync
+ * is given; without io_uring (kernel before 5.6, headers without it or
+ * io_uring disabled) the sync backend is used instead.
+ */
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_enter)
+#define TDX_CFG_HAVE_URING
+#endif
+
+enum {
+	NV_IO_AUTO,
+	NV_IO_SYNC,
+	NV_IO_URING,
+};
+
+static int nv_io = NV_IO_AUTO;
+
+struct nv_read_req {
+	struct non_volatile_device dev;
+	/* TDX_WANT_* tags to decode into data, 0 to read the whole block */
+	u32 want;
 	struct tdx_data data;
-	char tdx_car_serial_str[SERIAL_STR_LEN + 1];
-	char tdx_car_rev_str[MODULE_VER_STR_LEN + MODULE_REV_STR_LEN + 1];
-	const char *tdx_carrier_board_name;
+	/*
+	 * 0 with the block read, -ENOENT without a valid header, or the
+	 * result of parsing it for want
+	 */
+	int ret;
+	/* Bytes of block read so far */
+	size_t avail;
+	/* io_uring backend state */
+	int fd;
+	int res;
+	int done;
+	size_t len;
+	const char *open_path;
+	char fake_path[PATH_MAX];
+#ifdef TDX_CFG_HAVE_URING
+	struct __kernel_timespec delay;
+#endif
+	u8 block[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+};
 
-	int ret = read_tdx_cfg_block_carrier(nv_dev, &data);
-	if (ret) {
-		printf("Failed to load Toradex carrier config block: %d\n",
-				ret);
-		return CMD_RET_FAILURE;
+/*
+ * Number of bytes of req->block to read next, following the header first
+ * walk of fetch_tdx_cfg_block(). 0 when done, with req->ret set.
+ */
+static size_t nv_read_next(struct nv_read_req *req)
+{
+	struct toradex_tag *tag = (struct toradex_tag *)req->block;
+	size_t size = nv_block_size(&req->dev), need = 0;
+
+	if (size > sizeof(req->block)) {
+		req->ret = -EINVAL;
+		return 0;
 	}
 
-	tdx_carrier_board_name =
-		get_toradex_carrier_boards(data.car_hw_tag.prodid);
+	if (req->want) {
+		req->ret = parse_tdx_cfg_block_timed(req->block, req->avail,
+				size, req->want, &req->data, &need);
+		if (req->ret != -EAGAIN)
+			return 0;
+		if (need > size)
+			need = size;
+		if (need <= req->avail) {
+			/* Ran off the end of the block */
+			req->ret = -EINVAL;
+			return 0;
+		}
+		return need - req->avail;
+	}
 
-	snprintf(tdx_car_serial_str, sizeof(tdx_car_serial_str),
-			"%08u", data.car_serial);
-	snprintf(tdx_car_rev_str, sizeof(tdx_car_rev_str),
-			"V%1d.%1d%s",
-			data.car_hw_tag.ver_major,
-			data.car_hw_tag.ver_minor,
-			get_board_assembly(data.car_hw_tag.ver_assembly));
-
-	printf("carrier_prodid=\"%04d\"\n"
-			"carrier_prodname=\"%s\"\n"
-			"carrier_rev=\"%s\"\n"
-			"carrier_serial=\"%s\"\n",
-			data.car_hw_tag.prodid,
-			tdx_carrier_board_name,
-			tdx_car_rev_str,
-			tdx_car_serial_str);
+	req->ret = 0;
+	if (!req->avail)
+		return sizeof(*tag);
+	if (tag->flags != TDX_TAG_FLAG_VALID || tag->id != TDX_TAG_VALID) {
+		req->ret = -ENOENT;
+		return 0;
+	}
+	return size - req->avail;
+}
 
-	return CMD_RET_SUCCESS;
+static void nv_read_blocks_sync(struct nv_read_req *reqs, unsigned int n)
+{
+	struct nv_handle h;
+	size_t len;
+
+	for (unsigned int i = 0; i < n; i++) {
+		struct nv_read_req *req = &reqs[i];
+
+		req->avail = 0;
+		req->ret = nv_open(&h, &req->dev, O_RDONLY);
+		if (req->ret)
+			continue;
+
+		while ((len = nv_read_next(req))) {
+			if (read_nv_device_data(&h, req->avail,
+						req->block + req->avail, len)) {
+				req->ret = -EIO;
+				break;
+			}
+			req->avail += len;
+		}
+
+		nv_close(&h);
+	}
 }
 
-static int do_cfgblock_print(const struct non_volatile_device* nv_dev)
+#ifdef TDX_CFG_HAVE_URING
+#define TDX_CFG_URING_ENTRIES	64
+#define TDX_CFG_URING_BATCH	(TDX_CFG_URING_ENTRIES / 2)	/* op + delay */
+
+struct nv_uring {
+	int fd;
+	unsigned int queued;
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+static void nv_uring_exit(struct nv_uring *r)
 {
-	struct tdx_data data;
-	char tdx_serial_str[SERIAL_STR_LEN + 1];
-	char tdx_board_rev_str[MODULE_VER_STR_LEN + MODULE_REV_STR_LEN + 1];
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_map && r->cq_map != r->sq_map)
+		munmap(r->cq_map, r->cq_len);
+	if (r->sq_map)
+		munmap(r->sq_map, r->sq_len);
+	close(r->fd);
+}
 
-	int ret = read_tdx_cfg_block(nv_dev, &data);
-	if (ret) {
-		printf("Failed to load Toradex config block: %d\n",
-				ret);
-		return CMD_RET_FAILURE;
+static int nv_uring_init(struct nv_uring *r)
+{
+	struct io_uring_params p;
+	void *map;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	nv_syscall();
+	r->fd = syscall(__NR_io_uring_setup, TDX_CFG_URING_ENTRIES, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	/* Kernels before 5.6 have neither IORING_OP_OPENAT nor _READ */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(r->fd);
+		return -ENOSYS;
 	}
 
-	snprintf(tdx_serial_str, sizeof(tdx_serial_str),
-			"%08u", data.serial);
-	snprintf(tdx_board_rev_str, sizeof(tdx_board_rev_str),
-			"V%1d.%1d%s",
-			data.hw_tag.ver_major,
-			data.hw_tag.ver_minor,
-			get_board_assembly(data.hw_tag.ver_assembly));
-
-	printf("module_prodid=\"%04d\"\n"
-			"module_prodname=\"%s\"\n"
-			"module_rev=\"%s\"\n"
-			"module_serial=\"%s\"\n",
-			data.hw_tag.prodid,
-			toradex_modules[data.hw_tag.prodid].name,
-			tdx_board_rev_str,
-			tdx_serial_str);
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(u32);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = r->sq_len;
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
 
-	return CMD_RET_SUCCESS;
+	map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (map == MAP_FAILED)
+		goto fail;
+	r->sq_map = map;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_map = r->sq_map;
+	} else {
+		map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, r->fd,
+			   IORING_OFF_CQ_RING);
+		if (map == MAP_FAILED)
+			goto fail;
+		r->cq_map = map;
+	}
+
+	map = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (map == MAP_FAILED)
+		goto fail;
+	r->sqes = map;
+
+	r->sq_tail = (unsigned int *)((u8 *)r->sq_map + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((u8 *)r->sq_map + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((u8 *)r->sq_map + p.sq_off.array);
+	r->cq_head = (unsigned int *)((u8 *)r->cq_map + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((u8 *)r->cq_map + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((u8 *)r->cq_map + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((u8 *)r->cq_map + p.cq_off.cqes);
+
+	return 0;
+
+fail:
+	nv_uring_exit(r);
+	return -ENOMEM;
 }
 
-static int do_cfgblock_carrier_list()
+/* Queue an operation on reqs[i], or the delay following it */
+static struct io_uring_sqe *nv_uring_sqe(struct nv_uring *r, unsigned int i,
+	int delay)
 {
-	for (int i = 0; i < ARRAY_SIZE(toradex_carrier_boards); i++)
-		printf("%04d\t%s\n", toradex_carrier_boards[i].pid4,
-							toradex_carrier_boards[i].name);
+	unsigned int index = (*r->sq_tail + r->queued++) & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[index];
 
-	return CMD_RET_SUCCESS;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (u64)i << 1 | delay;
+	r->sq_array[index] = index;
+
+	return sqe;
 }
 
-static int do_cfgblock_list()
+/* Read into req->block, followed by the simulated device latency if any */
+static void nv_uring_read(struct nv_uring *r, struct nv_read_req *reqs,
+	unsigned int i, size_t start, size_t len)
 {
-	for (int i = 0; i < ARRAY_SIZE(toradex_modules); i++) {
-		if (toradex_modules[i].is_enabled)
-			printf("%04d\t%s\n", i, toradex_modules[i].name);
+	struct nv_read_req *req = &reqs[i];
+	off_t pos = req->dev.offset + start;
+	unsigned long us = req->open_path != req->dev.path ?
+			   nv_fake_us(pos, len, 0) : 0;
+	struct io_uring_sqe *sqe = nv_uring_sqe(r, i, 0);
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = req->fd;
+	sqe->addr = (uintptr_t)(req->block + start);
+	sqe->len = len;
+	sqe->off = pos;
+	__atomic_fetch_add(&nv_stats.reads, 1, __ATOMIC_RELAXED);
+	TDX_TRACE3(read_start, req->dev.path, (long long)pos, (int)len);
+
+	if (!us)
+		return;
+
+	sqe->flags |= IOSQE_IO_LINK;
+	req->delay.tv_sec = us / 1000000;
+	req->delay.tv_nsec = us % 1000000 * 1000;
+	sqe = nv_uring_sqe(r, i, 1);
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (uintptr_t)&req->delay;
+	sqe->len = 1;
+}
+
+/* Submit everything queued and wait for all of it, results go to res */
+static int nv_uring_run(struct nv_uring *r, struct nv_read_req *reqs)
+{
+	unsigned int queued = r->queued, submit = queued, done = 0;
+	unsigned int head, tail;
+	int ret;
+
+	__atomic_store_n(r->sq_tail, *r->sq_tail + queued, __ATOMIC_RELEASE);
+	r->queued = 0;
+
+	while (done < queued) {
+		nv_syscall();
+		ret = syscall(__NR_io_uring_enter, r->fd, submit,
+			      queued - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR)
+			return -errno;
+		if (ret > 0)
+			submit -= ret;
+
+		head = *r->cq_head;
+		tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++, done++) {
+			struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+			if (!(cqe->user_data & 1))
+				reqs[cqe->user_data >> 1].res = cqe->res;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
 	}
 
-	return CMD_RET_SUCCESS;
+	return 0;
 }
 
-static void usage()
+static int nv_read_blocks_uring(struct nv_read_req *reqs, unsigned int n)
 {
-	printf("Toradex config block handling commands\n"
-	"create [-y] [barcode]         - (Re-)create Toradex config block\n"
-	"create carrier [-y] [barcode] - (Re-)create Toradex Carrier config block\n"
-	"print                         - Print Toradex config block in flash\n"
-	"print carrier                 - Print Toradex Carrier config block in flash\n"
-	"list                          - Print supported module IDs and name\n"
-	"list carrier                  - Print supported carrier IDs and name\n");
+	struct io_uring_sqe *sqe;
+	struct timespec start;
+	int timed = stats_mode || TDX_TRACE_ENABLED(read_done);
+	struct nv_uring r;
+	unsigned int queued;
+	uint64_t ns;
+	int ret;
+
+	ret = nv_uring_init(&r);
+	if (ret)
+		return ret;
+
+	for (unsigned int base = 0; base < n; base += TDX_CFG_URING_BATCH) {
+		struct nv_read_req *batch = reqs + base;
+		unsigned int count = n - base < TDX_CFG_URING_BATCH ?
+				     n - base : TDX_CFG_URING_BATCH;
+
+		stats_start(&start);
+		for (unsigned int i = 0; i < count; i++) {
+			struct nv_read_req *req = &batch[i];
+
+			req->open_path = nv_fake_path(req->dev.path,
+						      req->fake_path,
+						      sizeof(req->fake_path));
+			req->fd = -1;
+			req->res = -ECANCELED;
+			req->avail = 0;
+			req->len = 0;
+			req->done = 0;
+			sqe = nv_uring_sqe(&r, i, 0);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uintptr_t)req->open_path;
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+			__atomic_fetch_add(&nv_stats.opens, 1,
+					   __ATOMIC_RELAXED);
+		}
+		ret = nv_uring_run(&r, batch);
+		ns = stats_stop(PHASE_OPEN, &start);
+		if (ret)
+			break;
+
+		for (unsigned int i = 0; i < count; i++) {
+			struct nv_read_req *req = &batch[i];
+
+			req->ret = req->res < 0 ? req->res : 0;
+			stats_probe(req->dev.path, req->dev.type, req->ret, ns);
+			if (req->ret)
+				req->done = 1;
+			else
+				req->fd = req->res;
+		}
+
+		/* One read per device and round: the header, then the rest */
+		do {
+			queued = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				struct nv_read_req *req = &batch[i];
+
+				if (req->done)
+					continue;
+
+				if (req->len) {
+					TDX_TRACE5(read_done, req->dev.path,
+						   (long long)(req->dev.offset +
+							       req->avail),
+						   (int)req->len,
+						   req->res == req->len ? 0 : -1,
+						   ns);
+					if (req->res != req->len) {
+						req->ret = -EIO;
+						req->done = 1;
+						continue;
+					}
+					__atomic_fetch_add(&nv_stats.bytes_read,
+							   req->len,
+							   __ATOMIC_RELAXED);
+					req->avail += req->len;
+				}
+
+				req->len = nv_read_next(req);
+				if (!req->len) {
+					req->done = 1;
+					continue;
+				}
+
+				req->res = -ECANCELED;
+				nv_uring_read(&r, batch, i, req->avail,
+					      req->len);
+				queued++;
+			}
+			if (!queued)
+				break;
+
+			if (timed)
+				clock_gettime(CLOCK_MONOTONIC, &start);
+			ret = nv_uring_run(&r, batch);
+			if (timed)
+				ns = stats_elapsed(PHASE_READ, &start);
+		} while (!ret);
+
+		for (unsigned int i = 0; i < count; i++) {
+			struct nv_read_req *req = &batch[i];
+
+			if (req->fd == -1)
+				continue;
+
+			if (ret) {
+				nv_syscall();
+				close(req->fd);
+			} else {
+				sqe = nv_uring_sqe(&r, i, 0);
+				sqe->opcode = IORING_OP_CLOSE;
+				sqe->fd = req->fd;
+			}
+			req->fd = -1;
+		}
+		if (ret || nv_uring_run(&r, batch))
+			break;
+	}
+
+	nv_uring_exit(&r);
+
+	return ret;
 }
+#else
+static int nv_read_blocks_uring(struct nv_read_req *reqs, unsigned int n)
+{
+	return -ENOSYS;
+}
+#endif
 
-int main(int argc, char *const argv[])
+/*
+ * Read the config blocks of reqs[] through io_uring unless --io sync is
+ * given. Gives -errno when that isn't possible, and from then on always.
+ */
+static int nv_read_blocks_batched(struct nv_read_req *reqs, unsigned int n)
 {
-	int ret, i;
-	int carrier = 0, force_overwrite = 0;
-	char *barcode = NULL;
-	const struct non_volatile_device* nv_dev;
+	int ret;
 
-	if (argc < 2) {
-		usage();
-		return CMD_RET_USAGE;
+	if (nv_io == NV_IO_SYNC)
+		return -ENOSYS;
+
+	ret = nv_read_blocks_uring(reqs, n);
+	if (ret) {
+		if (nv_io == NV_IO_URING)
+			printf("warning: io_uring not available (%s), reading "
+			       "devices one by one.\n", strerror(-ret));
+		nv_io = NV_IO_SYNC;
 	}
 
-	for (i=2; i<argc; ++i) {
-		if (!strcmp(argv[i], "carrier")) {
-			carrier = 1;
-		} else if (!strcmp(argv[i], "-y")) {
-			force_overwrite = 1;
-		} else {
-			barcode = argv[i];
-		}
+	return ret;
+}
+
+/* Read the config block of every device of reqs[] */
+static void nv_read_blocks(struct nv_read_req *reqs, unsigned int n)
+{
+	if (nv_read_blocks_batched(reqs, n))
+		nv_read_blocks_sync(reqs, n);
+}
+
+/*
+ * The devices holding config blocks are resolved at run time. Candidates
+ * listed in TDX_CFG_CONF_FILE, one "<module|carrier|display> <path>
+ * [offset [size]]" per line, come first. Unless it says "discover off",
+ * they are followed by every MMC boot partition and nvmem device found in
+ * sysfs that holds a config block, typed by its tags, then by the MMC boot
+ * partitions without one and the nv_devs[] defaults that exist, for create
+ * on blank parts. Discovery reads a 4 byte header per device, batched
+ * through nv_read_blocks(), and the blocks of the valid ones, so the
+ * resolved map is kept in TDX_CFG_DEVICE_MAP and later invocations only
+ * read that file, until the next boot, a change of the config file or
+ * cache clear.
+ */
+#define TDX_CFG_CONF_FILE	"/etc/tdx-cfgblock.conf"
+#define TDX_CFG_DEVICE_MAP	TDX_CFG_CACHE_DIR "/devices"
+#define TDX_CFG_DEVICE_MAP_HDR	"# tdx-cfgblock device map 1\n"
+#define TDX_CFG_DEVICES_MAX	32
+#define TDX_CFG_DISCOVER_MAX	128	/* candidates probed by discovery */
+#define TDX_CFG_NVMEM_DIR	"/sys/bus/nvmem/devices"
+#define TDX_CFG_MMC_DIR		"/sys/block"
+
+static struct non_volatile_device nv_table[TDX_CFG_DEVICES_MAX];
+static unsigned int nv_table_count;
+static int nv_table_loaded;
+
+static void nv_table_add(int type, const char *path, off_t offset,
+	size_t size)
+{
+	struct non_volatile_device *nv_dev;
+	char *copy;
+
+	for (unsigned int i = 0; i < nv_table_count; i++) {
+		if (!strcmp(nv_table[i].path, path) &&
+		    nv_table[i].offset == offset)
+			return;
 	}
 
-	nv_dev = first_valid_nv_dev(carrier ? TDX_EEPROM_ID_CARRIER :
-										TDX_EEPROM_ID_MODULE);
-	if (!nv_dev)
-		return -ENODEV;
+	if (nv_table_count == TDX_CFG_DEVICES_MAX) {
+		printf("warning: more than %d config block devices, '%s' "
+		       "ignored.\n", TDX_CFG_DEVICES_MAX, path);
+		return;
+	}
 
-	if (!strcmp(argv[1], "create")) {
-		if (carrier) {
-			return do_cfgblock_carrier_create(nv_dev, force_overwrite, barcode);
-		} else {
-			return do_cfgblock_create(nv_dev, force_overwrite, barcode);
-		}
-	} else if (!strcmp(argv[1], "print")) {
-		if (carrier) {
-			return do_cfgblock_carrier_print(nv_dev);
-		} else {
-			return do_cfgblock_print(nv_dev);
+	copy = strdup(path);
+	if (!copy)
+		return;
+
+	nv_dev = &nv_table[nv_table_count++];
+	memset(nv_dev, 0, sizeof(*nv_dev));
+	nv_dev->type = type;
+	nv_dev->path = copy;
+	nv_dev->offset = offset;
+	nv_dev->size = size;
+}
+
+static void nv_table_reset(void)
+{
+	for (unsigned int i = 0; i < nv_table_count; i++)
+		free((char *)nv_table[i].path);
+	nv_table_count = 0;
+}
+
+/*
+ * Parse "<type> <path> [offset [size]]" of the config file and the device
+ * map. Returns 1 for blank and comment lines and -EINVAL for bad ones.
+ */
+static int nv_table_parse(char *line, int *type, char **path, off_t *offset,
+	size_t *size)
+{
+	char *type_name, *offset_str, *size_str, *extra, *save, *end;
+
+	type_name = strtok_r(line, " \t\r\n", &save);
+	if (!type_name || type_name[0] == '#')
+		return 1;
+
+	*path = strtok_r(NULL, " \t\r\n", &save);
+	offset_str = strtok_r(NULL, " \t\r\n", &save);
+	size_str = strtok_r(NULL, " \t\r\n", &save);
+	extra = strtok_r(NULL, " \t\r\n", &save);
+
+	*type = tdx_type_from_name(type_name);
+	if (*type < 0 || !*path || (*path)[0] != '/' || extra)
+		return -EINVAL;
+
+	*offset = 0;
+	*size = 0;
+	if (offset_str) {
+		*offset = strtoll(offset_str, &end, 0);
+		if (*end || *offset < 0)
+			return -EINVAL;
+	}
+	if (size_str) {
+		*size = strtoul(size_str, &end, 0);
+		if (*end || *size > TDX_CFG_BLOCK_BUF_SIZE ||
+		    (*size && *size < TDX_CFG_BLOCK_MIN_SIZE))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Add the config file candidates, *discover tells whether to go on */
+static void nv_conf_load(const char *name, int *discover)
+{
+	char *line = NULL, *path;
+	size_t line_size = 0;
+	unsigned long lineno = 0;
+	size_t size;
+	off_t offset;
+	int type, ret;
+	FILE *f;
+
+	*discover = 1;
+	f = fopen(name, "r");
+	if (!f)
+		return;
+
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		if (!strncmp(line, "discover ", 9)) {
+			if (!strncmp(line + 9, "off", 3))
+				*discover = 0;
+			continue;
 		}
-	} else if (!strcmp(argv[1], "list")) {
-		if (carrier) {
-			return do_cfgblock_carrier_list();
-		} else {
-			return do_cfgblock_list();
+
+		ret = nv_table_parse(line, &type, &path, &offset, &size);
+		if (ret < 0)
+			printf("error: %s:%lu: invalid device entry.\n",
+			       TDX_CFG_CONF_FILE, lineno);
+		else if (!ret)
+			nv_table_add(type, path, offset, size);
+	}
+
+	free(line);
+	fclose(f);
+}
+
+/*
+ * Type of a config block read by nv_read_blocks(), going by its tags: a MAC
+ * makes a module block, a carrier serial a carrier board or, for a known
+ * display adapter product id, a display adapter block. -ENOENT for neither.
+ */
+static int nv_block_type(const u8 *block, size_t size)
+{
+	const struct tdx_tlv_entry *entry;
+	struct tdx_tlv_index index;
+	struct toradex_hw hw;
+	int ret = -ENOENT;
+
+	tdx_tlv_index_build(block, size, &index);
+	if (tdx_tlv_lookup(&index, TDX_TAG_MAC)) {
+		ret = TDX_EEPROM_ID_MODULE;
+	} else if (tdx_tlv_lookup(&index, TDX_TAG_CAR_SERIAL)) {
+		ret = TDX_EEPROM_ID_CARRIER;
+		entry = tdx_tlv_lookup(&index, TDX_TAG_HW);
+		if (entry && entry->len >= sizeof(hw)) {
+			memcpy(&hw, block + entry->offset, sizeof(hw));
+			if (tdx_get_carrier_boards(hw.prodid) ==
+			    toradex_carrier_boards[0].name &&
+			    tdx_get_display_adapters(hw.prodid) !=
+			    toradex_display_adapters[0].name)
+				ret = TDX_EEPROM_ID_DISPLAY_ADAPTER;
 		}
 	}
 
-	usage();
-	return CMD_RET_USAGE;
+	return ret;
+}
+
+static int nv_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
 }
 
+/* Sorted names of the entries of a sysfs directory, NULL if there is none */
+static char **nv_list_dir(const char *dir, unsigned int *count)
+{
+	char fake_dir[PATH_MAX], **names = NULL, **grown;
+	unsigned int n = 0, alloc = 0;
+	struct dirent *de;
+	DIR *d;
+
+	*count = 0;
+	d = opendir(nv_fake_path(dir, fake_dir, sizeof(fake_dir)));
+	if (!d)
+		return NULL;
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+		if (n == alloc) {
+			alloc = alloc ? 2 * alloc : 16;
+			grown = realloc(names, alloc * sizeof(*names));
+			if (!grown)
+				break;
+			names = grown;
+		}
+		names[n] = strdup(de->d_name);
+		if (names[n])
+			n++;
+	}
+	closedir(d);
+
+	if (names)
+		qsort(names, n, sizeof(*names), nv_name_cmp);
+	*count = n;
+	return names;
+}
+
+static void nv_free_names(char **names, unsigned int count)
+{
+	for (unsigned int i = 0; names && i < count; i++)
+		free(names[i]);
+	free(names);
+}
+
+/* Config blocks sit in the last 512 bytes of the MMC boot partition */
+static off_t nv_mmc_offset(const char *name)
+{
+	char path[PATH_MAX], fake_path[PATH_MAX];
+	unsigned long long sectors = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), TDX_CFG_MMC_DIR "/%s/size", name);
+	f = fopen(nv_fake_path(path, fake_path, sizeof(fake_path)), "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%llu", &sectors) != 1)
+		sectors = 0;
+	fclose(f);
+
+	return sectors ? (off_t)(sectors - 1) * 512 : -1;
+}
+
+/* Add a discovery candidate to reqs[], read later by nv_read_blocks() */
+static void nv_discover_add(struct nv_read_req *reqs, unsigned int *n,
+	const char *path, off_t offset)
+{
+	struct non_volatile_device *dev;
+
+	if (*n >= TDX_CFG_DISCOVER_MAX)
+		return;
+
+	dev = &reqs[*n].dev;
+	dev->path = strdup(path);
+	if (!dev->path)
+		return;
+
+	dev->type = TDX_EEPROM_ID_MODULE;
+	dev->offset = offset;
+	(*n)++;
+}
+
+static void nv_discover(void)
+{
+	char path[PATH_MAX], fake_path[PATH_MAX], **names;
+	unsigned int count, nmmc, n = 0;
+	struct nv_read_req *reqs;
+	int unit, len;
+	off_t offset;
+
+	reqs = calloc(TDX_CFG_DISCOVER_MAX, sizeof(*reqs));
+	if (!reqs)
+		return;
+
+	/* MMC boot partitions: mmcblk<n>boot0 */
+	names = nv_list_dir(TDX_CFG_MMC_DIR, &count);
+	for (unsigned int i = 0; names && i < count; i++) {
+		len = 0;
+		if (sscanf(names[i], "mmcblk%dboot0%n", &unit, &len) != 1 ||
+		    names[i][len])
+			continue;
+
+		offset = nv_mmc_offset(names[i]);
+		if (offset < 0)
+			continue;
+
+		snprintf(path, sizeof(path), "/dev/%s", names[i]);
+		nv_discover_add(reqs, &n, path, offset);
+	}
+	nv_free_names(names, count);
+	nmmc = n;
+
+	/* nvmem devices: EEPROMs of the module, carrier board and display */
+	names = nv_list_dir(TDX_CFG_NVMEM_DIR, &count);
+	for (unsigned int i = 0; names && i < count; i++) {
+		snprintf(path, sizeof(path), TDX_CFG_NVMEM_DIR "/%s/nvmem",
+			 names[i]);
+		nv_discover_add(reqs, &n, path, 0);
+	}
+	nv_free_names(names, count);
+
+	nv_read_blocks(reqs, n);
+
+	for (unsigned int i = 0; i < n; i++) {
+		if (!reqs[i].ret)
+			reqs[i].ret = nv_block_type(reqs[i].block,
+						    nv_block_size(&reqs[i].dev));
+		if (reqs[i].ret >= 0 &&
+		    (i >= nmmc || reqs[i].ret == TDX_EEPROM_ID_MODULE))
+			nv_table_add(reqs[i].ret, reqs[i].dev.path,
+				     reqs[i].dev.offset, 0);
+	}
+
+	/* MMC boot partitions without a module block, for create */
+	for (unsigned int i = 0; i < nmmc; i++) {
+		if (reqs[i].ret != TDX_EEPROM_ID_MODULE)
+			nv_table_add(TDX_EEPROM_ID_MODULE, reqs[i].dev.path,
+				     reqs[i].dev.offset, 0);
+	}
+
+	for (unsigned int i = 0; i < n; i++)
+		free((char *)reqs[i].dev.path);
+	free(reqs);
+
+	for (int i = 0; i < ARRAY_SIZE(nv_devs); i++) {
+		if (!access(nv_fake_path(nv_devs[i].path, fake_path,
+					 sizeof(fake_path)), F_OK))
+			nv_table_add(nv_devs[i].type, nv_devs[i].path,
+				     nv_devs[i].offset, nv_devs[i].size);
+	}
+}
+
+/* Read the device map unless it's missing or older than the config file */
+static int nv_map_load(void)
+{
+	char map[PATH_MAX], conf[PATH_MAX], *line = NULL, *path;
+	size_t line_size = 0, size;
+	struct stat map_st, conf_st;
+	off_t offset;
+	int type, ret = 0;
+	FILE *f;
+
+	f = fopen(nv_fake_path(TDX_CFG_DEVICE_MAP, map, sizeof(map)), "r");
+	if (!f)
+		return -ENOENT;
+
+	if (fstat(fileno(f), &map_st) ||
+	    (!stat(nv_fake_path(TDX_CFG_CONF_FILE, conf, sizeof(conf)),
+		   &conf_st) && (conf_st.st_mtim.tv_sec > map_st.st_mtim.tv_sec ||
+		   (conf_st.st_mtim.tv_sec == map_st.st_mtim.tv_sec &&
+		    conf_st.st_mtim.tv_nsec > map_st.st_mtim.tv_nsec))) ||
+	    getline(&line, &line_size, f) == -1 ||
+	    strcmp(line, TDX_CFG_DEVICE_MAP_HDR))
+		ret = -ESTALE;
+
+	while (!ret && getline(&line, &line_size, f) != -1) {
+		ret = nv_table_parse(line, &type, &path, &offset, &size);
+		if (!ret)
+			nv_table_add(type, path, offset, size);
+		else if (ret > 0)
+			ret = 0;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (ret)
+		nv_table_reset();
+
+	return ret;
+}
+
+static void nv_map_store(void)
+{
+	char fake_dir[PATH_MAX], map[PATH_MAX], tmp[PATH_MAX];
+	const char *dir;
+	int fd, failed;
+	FILE *f;
+
+	dir = nv_fake_path(TDX_CFG_CACHE_DIR, fake_dir, sizeof(fake_dir));
+	mkdir(dir, 0755);
+	if (snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", dir) >= sizeof(tmp))
+		return;
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	fputs(TDX_CFG_DEVICE_MAP_HDR, f);
+	for (unsigned int i = 0; i < nv_table_count; i++)
+		fprintf(f, "%s %s 0x%llx %zu\n",
+			nv_dev_type_name[nv_table[i].type], nv_table[i].path,
+			(long long)nv_table[i].offset, nv_table[i].size);
+
+	/* Publish the map atomically so readers never see a partial one */
+	failed = fchmod(fd, 0644);
+	if (fclose(f) || failed ||
+	    rename(tmp, nv_fake_path(TDX_CFG_DEVICE_MAP, map, sizeof(map))))
+		unlink(tmp);
+}
+
+/*
+ * Drop the device map after a block was written to a device it doesn't list
+ * with that type, e.g. a blank EEPROM given to batch, so that the next
+ * invocation discovers it. Image files are never discovered. Only reads
+ * nv_table[], gang workers call this.
+ */
+static void nv_map_written(const struct non_volatile_device *nv_dev)
+{
+	char map[PATH_MAX];
+
+	if (nv_dev == &image_dev ||
+	    (strncmp(nv_dev->path, "/dev/", 5) &&
+	     strncmp(nv_dev->path, TDX_CFG_NVMEM_DIR "/",
+		     strlen(TDX_CFG_NVMEM_DIR "/"))))
+		return;
+
+	for (unsigned int i = 0; i < nv_table_count; i++) {
+		if (nv_table[i].type == nv_dev->type &&
+		    nv_table[i].offset == nv_dev->offset &&
+		    !strcmp(nv_table[i].path, nv_dev->path))
+			return;
+	}
+
+	unlink(nv_fake_path(TDX_CFG_DEVICE_MAP, map, sizeof(map)));
+}
+
+/* Resolve nv_table[], from the device map when possible */
+static void nv_table_load(int rescan)
+{
+	char conf[PATH_MAX];
+	struct timespec start;
+	int discover;
+
+	if (nv_table_loaded && !rescan)
+		return;
+	nv_table_loaded = 1;
+	nv_table_reset();
+
+	if (!rescan && !nv_map_load())
+		return;
+
+	stats_start(&start);
+	nv_conf_load(nv_fake_path(TDX_CFG_CONF_FILE, conf, sizeof(conf)),
+		     &discover);
+	if (discover)
+		nv_discover();
+	stats_stop(PHASE_DISCOVER, &start);
+
+	nv_map_store();
+}
+
+static int do_cfgblock_devices(int argc, char *argv[])
+{
+	int rescan = 0;
+
+	for (int i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "rescan")) {
+			printf("error: usage: devices [rescan]\n");
+			return CMD_RET_USAGE;
+		}
+		rescan = 1;
+	}
+
+	nv_table_load(rescan);
+	for (unsigned int i = 0; i < nv_table_count; i++)
+		printf("type=%s path=\"%s\" offset=0x%llx size=%zu\n",
+		       nv_dev_type_name[nv_table[i].type], nv_table[i].path,
+		       (long long)nv_table[i].offset,
+		       nv_block_size(&nv_table[i]));
+
+	return CMD_RET_SUCCESS;
+}
+
+static int first_valid_nv_dev_probe(u32 type, int flags,
+	struct nv_handle *h)
+{
+	int ret;
+
+	if (image_dev.path) {
+		/* Images to be written may not exist yet */
+		if ((flags & O_ACCMODE) != O_RDONLY)
+			flags |= O_CREAT;
+		image_dev.type = type;
+		ret = nv_open(h, &image_dev, flags);
+		if (ret)
+			printf("error: cannot open image '%s': %s\n",
+			       image_dev.path, strerror(-ret));
+		return ret;
+	}
+
+	nv_table_load(0);
+	for (unsigned int i = 0; i < nv_table_count; i++) {
+		const struct non_volatile_device *nv_dev = &nv_table[i];
+		if (nv_dev->type == type && !nv_open(h, nv_dev, flags))
+			return 0;
+	}
+
+	printf("error: no %s config block device found.\n",
+	       nv_dev_type_name[type]);
+	return -ENODEV;
+}
+
+static int first_valid_nv_dev(u32 type, int flags, struct nv_handle *h)
+{
+	struct timespec start;
+	int ret;
+
+	stats_start(&start);
+	ret = first_valid_nv_dev_probe(type, flags, h);
+	stats_stop(PHASE_PROBE, &start);
+
+	return ret;
+}
+
+/*
+ * Resolve a batch target, "<path>[@<offset>]", into a device description.
+ * Without an explicit offset, paths of the device table use their offset and
+ * anything else starts at 0.
+ */
+static int parse_nv_target(char *target, u32 type,
+	struct non_volatile_device *nv_dev)
+{
+	char *at = strrchr(target, '@');
+	char *end;
+
+	memset(nv_dev, 0, sizeof(*nv_dev));
+	nv_dev->type = type;
+	nv_dev->path = target;
+
+	if (at) {
+		*at = '\0';
+		nv_dev->offset = strtoll(at + 1, &end, 0);
+		if (*end || at[1] == '\0')
+			return -EINVAL;
+		return 0;
+	}
+
+	nv_table_load(0);
+	for (unsigned int i = 0; i < nv_table_count; i++) {
+		if (!strcmp(nv_table[i].path, target)) {
+			nv_dev->offset = nv_table[i].offset;
+			nv_dev->size = nv_table[i].size;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* Target and barcode of a batch record, on failure *error describes why */
+static int batch_decode(char *target, const char *type_name, char *barcode,
+	struct non_volatile_device *nv_dev, struct tdx_data *data,
+	const char **error)
+{
+	struct toradex_hw *hw;
+	u32 *serial;
+	int type, ret;
+
+	memset(data, 0, sizeof(*data));
+
+	type = tdx_type_from_name(type_name);
+	if (type < 0) {
+		*error = "unknown block type";
+		return -EINVAL;
+	}
+
+	if (parse_nv_target(target, type, nv_dev)) {
+		*error = "invalid target";
+		return -EINVAL;
+	}
+
+	if (type == TDX_EEPROM_ID_MODULE) {
+		hw = &data->hw_tag;
+		serial = &data->serial;
+	} else {
+		hw = &data->car_hw_tag;
+		serial = &data->car_serial;
+	}
+
+	ret = tdx_barcode_decode(barcode, strlen(barcode), hw, serial);
+	if (!ret)
+		ret = tdx_barcode_check(type, hw, *serial);
+	if (ret) {
+		*error = tdx_barcode_error[ret];
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Provision one batch record, on failure *error describes why */
+static int batch_record(char *target, const char *type_name, char *barcode,
+	int force_overwrite, struct tdx_data *data,
+	struct nv_write_report *report, const char **error)
+{
+	struct non_volatile_device nv_dev;
+	struct tdx_data old;
+	struct nv_handle h;
+	int type, ret;
+
+	memset(report, 0, sizeof(*report));
+
+	ret = batch_decode(target, type_name, barcode, &nv_dev, data, error);
+	if (ret)
+		return ret;
+	type = nv_dev.type;
+
+	ret = nv_open(&h, &nv_dev, O_RDWR);
+	if (ret) {
+		*error = "cannot open target";
+		return ret;
+	}
+
+	if (!force_overwrite &&
+	    !read_tdx_data(&h, tdx_data_want_all(type), &old)) {
+		*error = "valid config block present";
+		ret = -EEXIST;
+	} else {
+		ret = write_tdx_data(&h, data, report);
+		if (ret)
+			*error = "write failed";
+		else
+			nv_map_written(&nv_dev);
+	}
+
+	nv_close(&h);
+	return ret;
+}
+
+/*
+ * Provision many devices or images from one process. Every input line is a
+ * record "<target> <module|carrier|display> <barcode>"; blank lines and
+ * lines starting with '#' are skipped. One status line is printed per record
+ * and a throughput summary goes to stderr.
+ */
+static int do_cfgblock_batch(int argc, char *argv[])
+{
+	const char *input = "-";
+	int force_overwrite = 0;
+	struct timespec start;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned long lineno = 0, ok = 0, failed = 0;
+	double secs;
+	FILE *f;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-y"))
+			force_overwrite = 1;
+		else
+			input = argv[i];
+	}
+
+	f = strcmp(input, "-") ? fopen(input, "r") : stdin;
+	if (!f) {
+		printf("error: cannot open '%s'.\n", input);
+		return CMD_RET_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (getline(&line, &line_size, f) != -1) {
+		char *target, *type_name, *barcode, *extra, *save;
+		char serial[SERIAL_STR_LEN + 1];
+		struct nv_write_report report;
+		struct tdx_data data;
+		const char *error = "malformed record";
+		u32 serial_num;
+		int ret = -EINVAL;
+
+		lineno++;
+		target = strtok_r(line, " \t\r\n", &save);
+		if (!target || target[0] == '#')
+			continue;
+		type_name = strtok_r(NULL, " \t\r\n", &save);
+		barcode = strtok_r(NULL, " \t\r\n", &save);
+		extra = strtok_r(NULL, " \t\r\n", &save);
+
+		if (type_name && barcode && !extra)
+			ret = batch_record(target, type_name, barcode,
+					   force_overwrite, &data, &report,
+					   &error);
+
+		if (ret) {
+			failed++;
+			printf("line=%lu target=\"%s\" status=error error=\"%s\"\n",
+			       lineno, target, error);
+			continue;
+		}
+
+		ok++;
+		serial_num = strcmp(type_name, "module") ? data.car_serial :
+							   data.serial;
+		snprintf(serial, sizeof(serial), "%08u", serial_num);
+		printf("line=%lu target=\"%s\" status=ok type=%s serial=%s "
+		       "pages=%d\n", lineno, target, type_name, serial,
+		       report.pages);
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	secs = elapsed_ms(&start) / 1e3;
+	fprintf(stderr, "records=%lu ok=%lu failed=%lu elapsed=%.3fs "
+		"rate=%.0f/s\n", ok + failed, ok, failed, secs,
+		secs > 0 ? (ok + failed) / secs : 0);
+
+	return failed ? CMD_RET_FAILURE : CMD_RET_SUCCESS;
+}
+
+/*
+ * Gang programming for fixtures holding several boards: the records, as for
+ * batch, are encoded up front and then written by one thread per bus, so
+ * the EEPROM write cycles of different buses overlap and the wall time is
+ * about that of the busiest bus. Every block is read back and compared
+ * after writing. The results are printed as a table in input order.
+ */
+#define TDX_CFG_GANG_MAX	256
+#define TDX_CFG_GANG_BUS_LEN	32
+
+struct gang_record {
+	char *line;
+	unsigned long lineno;
+	char *target;
+	const char *type_name;
+	struct non_volatile_device nv_dev;
+	struct tdx_data data;
+	u8 block[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	size_t size;
+	char bus[TDX_CFG_GANG_BUS_LEN];
+	unsigned int worker;
+	int ret;
+	const char *error;
+	struct nv_write_report report;
+	double msecs;
+};
+
+struct gang_worker {
+	struct gang_record *records;
+	unsigned int count;
+	unsigned int index;
+	int force_overwrite;
+	pthread_t thread;
+	int started;
+};
+
+/*
+ * Bus of a target: nvmem devices "<bus>-<address>" share I2C bus <bus>,
+ * any other device or image file is taken to be on a bus of its own.
+ */
+static void gang_bus(const char *path, char *bus, size_t size)
+{
+	const char *name = path + strlen(TDX_CFG_NVMEM_DIR "/");
+	size_t len;
+
+	if (!strncmp(path, TDX_CFG_NVMEM_DIR "/", name - path)) {
+		len = strcspn(name, "-/");
+		if (name[len] == '-') {
+			snprintf(bus, size, "i2c-%.*s", (int)len, name);
+			return;
+		}
+	}
+
+	snprintf(bus, size, "%s", path);
+}
+
+/* Write and verify one record, on failure rec->error describes why */
+static void gang_write(struct gang_record *rec, int force_overwrite)
+{
+	u8 check[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	struct timespec start;
+	struct tdx_data old;
+	struct nv_handle h;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	rec->ret = nv_open(&h, &rec->nv_dev, O_RDWR);
+	if (rec->ret) {
+		rec->error = "cannot open target";
+		goto out;
+	}
+
+	if (!force_overwrite &&
+	    !read_tdx_data(&h, tdx_data_want_all(rec->nv_dev.type), &old)) {
+		rec->error = "valid config block present";
+		rec->ret = -EEXIST;
+		goto close;
+	}
+
+	cfg_cache_invalidate(&h);
+	rec->ret = write_nv_device_data_diff(&h, 0, rec->block, rec->size,
+					     NULL, &rec->report);
+	cfg_cache_invalidate(&h);
+	if (rec->ret) {
+		rec->error = "write failed";
+		goto close;
+	}
+	nv_map_written(&rec->nv_dev);
+
+	/* Read back from the device, not from the page cache */
+	nv_syscall();
+	fsync(h.fd);
+	nv_syscall();
+	posix_fadvise(h.fd, rec->nv_dev.offset, rec->size,
+		      POSIX_FADV_DONTNEED);
+	if (read_nv_device_data(&h, 0, check, rec->size) ||
+	    memcmp(check, rec->block, rec->size)) {
+		rec->error = "verify failed";
+		rec->ret = -EIO;
+	}
+
+close:
+	nv_close(&h);
+out:
+	rec->msecs = elapsed_ms(&start);
+}
+
+static void *gang_worker_run(void *arg)
+{
+	struct gang_worker *worker = arg;
+
+	for (unsigned int i = 0; i < worker->count; i++) {
+		struct gang_record *rec = &worker->records[i];
+
+		if (!rec->ret && rec->worker == worker->index)
+			gang_write(rec, worker->force_overwrite);
+	}
+
+	return NULL;
+}
+
+static int gang_read_records(FILE *f, struct gang_record *records,
+	unsigned int *count)
+{
+	char *line = NULL, *target, *type_name, *barcode, *extra, *save;
+	size_t line_size = 0;
+	unsigned long lineno = 0;
+	struct gang_record *rec;
+	int ret = 0;
+
+	*count = 0;
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		target = strtok_r(line, " \t\r\n", &save);
+		if (!target || target[0] == '#')
+			continue;
+
+		if (*count == TDX_CFG_GANG_MAX) {
+			printf("error: more than %d records.\n",
+			       TDX_CFG_GANG_MAX);
+			ret = -E2BIG;
+			break;
+		}
+
+		rec = &records[(*count)++];
+		rec->lineno = lineno;
+		rec->line = line;
+		rec->target = target;
+		rec->error = "malformed record";
+		rec->ret = -EINVAL;
+		line = NULL;
+		line_size = 0;
+
+		type_name = strtok_r(NULL, " \t\r\n", &save);
+		barcode = strtok_r(NULL, " \t\r\n", &save);
+		extra = strtok_r(NULL, " \t\r\n", &save);
+		if (!type_name || !barcode || extra)
+			continue;
+
+		rec->type_name = type_name;
+		rec->ret = batch_decode(rec->target, type_name, barcode,
+					&rec->nv_dev, &rec->data, &rec->error);
+	}
+
+	free(line);
+	return ret;
+}
+
+static int do_cfgblock_gang_create(int argc, char *argv[])
+{
+	struct gang_worker workers[TDX_CFG_GANG_MAX];
+	struct gang_record *records;
+	const char *input = "-";
+	int force_overwrite = 0;
+	unsigned int count = 0, nworkers = 0, w;
+	unsigned long ok = 0, failed = 0;
+	char serial[SERIAL_STR_LEN + 1];
+	struct timespec start;
+	double secs;
+	int ret = CMD_RET_FAILURE;
+	FILE *f;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-y"))
+			force_overwrite = 1;
+		else
+			input = argv[i];
+	}
+
+	records = calloc(TDX_CFG_GANG_MAX, sizeof(*records));
+	if (!records)
+		return CMD_RET_FAILURE;
+
+	f = strcmp(input, "-") ? fopen(input, "r") : stdin;
+	if (!f) {
+		printf("error: cannot open '%s'.\n", input);
+		goto out;
+	}
+	if (gang_read_records(f, records, &count))
+		goto out;
+
+	/* Encode every block and give each bus its worker */
+	for (unsigned int i = 0; i < count; i++) {
+		struct gang_record *rec = &records[i];
+
+		if (rec->ret)
+			continue;
+
+		rec->size = nv_block_size(&rec->nv_dev);
+		if (rec->size > sizeof(rec->block)) {
+			rec->error = "invalid block size";
+			rec->ret = -EINVAL;
+			continue;
+		}
+		if (rec->nv_dev.type != TDX_EEPROM_ID_MODULE)
+			rec->ret = tdx_encode_cfg_block_carrier(rec->block,
+					rec->size, &rec->data);
+		else
+			rec->ret = tdx_encode_cfg_block(rec->block, rec->size,
+							&rec->data);
+		if (rec->ret == -ERANGE) {
+			rec->error = "no OUI for serial";
+			continue;
+		} else if (rec->ret) {
+			rec->error = "invalid block size";
+			continue;
+		}
+
+		gang_bus(rec->nv_dev.path, rec->bus, sizeof(rec->bus));
+		for (w = 0; w < nworkers; w++) {
+			if (!strcmp(records[workers[w].index].bus, rec->bus))
+				break;
+		}
+		if (w == nworkers) {
+			memset(&workers[w], 0, sizeof(workers[w]));
+			workers[w].records = records;
+			workers[w].count = count;
+			workers[w].index = i;
+			workers[w].force_overwrite = force_overwrite;
+			nworkers++;
+		}
+		rec->worker = workers[w].index;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (w = 0; w < nworkers; w++) {
+		if (!pthread_create(&workers[w].thread, NULL, gang_worker_run,
+				    &workers[w]))
+			workers[w].started = 1;
+		else
+			gang_worker_run(&workers[w]);
+	}
+
+	for (w = 0; w < nworkers; w++) {
+		if (workers[w].started)
+			pthread_join(workers[w].thread, NULL);
+	}
+
+	secs = elapsed_ms(&start) / 1e3;
+
+	printf("%-5s %-40s %-8s %-8s %-12s %-6s %5s %8s  %s\n", "LINE",
+	       "TARGET", "TYPE", "SERIAL", "BUS", "STATUS", "PAGES", "MS",
+	       "ERROR");
+	for (unsigned int i = 0; i < count; i++) {
+		struct gang_record *rec = &records[i];
+		int module = rec->nv_dev.type == TDX_EEPROM_ID_MODULE;
+
+		if (rec->ret)
+			failed++;
+		else
+			ok++;
+
+		if (rec->size)
+			snprintf(serial, sizeof(serial), "%08u",
+				 module ? rec->data.serial :
+					  rec->data.car_serial);
+		else
+			snprintf(serial, sizeof(serial), "-");
+
+		printf("%-5lu %-40s %-8s %-8s %-12s %-6s %5d %8.1f  %s\n",
+		       rec->lineno, rec->target,
+		       rec->type_name ? rec->type_name : "-", serial,
+		       rec->bus[0] ? rec->bus : "-",
+		       rec->ret ? "error" : "ok", rec->report.pages,
+		       rec->msecs, rec->ret ? rec->error : "");
+	}
+
+	fprintf(stderr, "records=%lu ok=%lu failed=%lu buses=%u "
+		"elapsed=%.3fs\n", ok + failed, ok, failed, nworkers, secs);
+
+	if (!failed && count)
+		ret = CMD_RET_SUCCESS;
+
+out:
+	if (f && f != stdin)
+		fclose(f);
+	for (unsigned int i = 0; i < count; i++)
+		free(records[i].line);
+	free(records);
+
+	return ret;
+}
+
+/*
+ * Bulk generation of module config block blobs for a serial range, e.g. to
+ * pre-stage images. Workers grab chunks of serials through an atomic counter,
+ * encode them exactly like `create` does and write each chunk with a single
+ * pwrite() into a packed file (serial first + i at offset i * block size), or
+ * write one "<serial>.bin" blob per serial into a directory.
+ */
+#define TDX_CFG_GENERATE_CHUNK	1024
+#define TDX_CFG_THREADS_MAX	256	/* upper bound for -j */
+
+struct generate_ctx {
+	struct toradex_hw hw_tag;
+	u32 first;
+	u32 count;
+	size_t size;
+	const char *dir;
+	int fd;
+	u32 next;
+	int error;
+};
+
+static int generate_blob(const struct generate_ctx *ctx, u32 serial,
+	const u8 *blob)
+{
+	char path[PATH_MAX];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%08u.bin", ctx->dir, serial);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	if (write(fd, blob, ctx->size) != ctx->size)
+		ret = -EIO;
+
+	close(fd);
+	return ret;
+}
+
+static void *generate_worker(void *arg)
+{
+	struct generate_ctx *ctx = arg;
+	size_t chunk_size = TDX_CFG_GENERATE_CHUNK * ctx->size;
+	struct tdx_data data;
+	u8 *buf;
+
+	buf = malloc(chunk_size);
+	if (!buf) {
+		__atomic_store_n(&ctx->error, -ENOMEM, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.hw_tag = ctx->hw_tag;
+
+	for (;;) {
+		u32 start = __atomic_fetch_add(&ctx->next,
+					       TDX_CFG_GENERATE_CHUNK,
+					       __ATOMIC_RELAXED);
+		u32 n;
+		int ret = 0;
+
+		if (start >= ctx->count ||
+		    __atomic_load_n(&ctx->error, __ATOMIC_RELAXED))
+			break;
+
+		n = ctx->count - start;
+		if (n > TDX_CFG_GENERATE_CHUNK)
+			n = TDX_CFG_GENERATE_CHUNK;
+
+		for (u32 i = 0; i < n && !ret; i++) {
+			data.serial = ctx->first + start + i;
+			tdx_encode_cfg_block(buf + i * ctx->size, ctx->size,
+					     &data);
+			if (ctx->dir)
+				ret = generate_blob(ctx, data.serial,
+						    buf + i * ctx->size);
+		}
+
+		if (!ret && ctx->fd != -1 &&
+		    pwrite(ctx->fd, buf, n * ctx->size,
+			   (off_t)start * ctx->size) != n * ctx->size)
+			ret = -EIO;
+
+		if (ret) {
+			__atomic_store_n(&ctx->error, ret, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* Run fn on `threads` threads, or inline where one can't be started */
+static void run_workers(int threads, void *(*fn)(void *), void *arg)
+{
+	pthread_t *thread = calloc(threads, sizeof(*thread));
+	char *started = calloc(threads, 1);
+
+	if (!thread || !started) {
+		free(thread);
+		free(started);
+		fn(arg);
+		return;
+	}
+
+	for (int i = 0; i < threads; i++) {
+		started[i] = !pthread_create(&thread[i], NULL, fn, arg);
+		if (!started[i])
+			fn(arg);
+	}
+
+	for (int i = 0; i < threads; i++) {
+		if (started[i])
+			pthread_join(thread[i], NULL);
+	}
+
+	free(thread);
+	free(started);
+}
+
+/* Default worker count, or parse and clamp a -j argument, 0 if invalid */
+static long parse_threads(const char *arg)
+{
+	long threads;
+	char *end;
+
+	if (!arg) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads < 1)
+			threads = 1;
+	} else {
+		threads = strtol(arg, &end, 0);
+		if (!*arg || *end)
+			return 0;
+	}
+
+	if (threads > TDX_CFG_THREADS_MAX)
+		threads = TDX_CFG_THREADS_MAX;
+
+	return threads;
+}
+
+/* Generate the whole range with `threads` workers, returns seconds taken */
+static double generate_run(struct generate_ctx *ctx, int threads)
+{
+	struct timespec start;
+
+	ctx->next = 0;
+	ctx->error = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_workers(threads, generate_worker, ctx);
+
+	return elapsed_ms(&start) / 1e3;
+}
+
+static int parse_serial(const char *s, u32 *serial)
+{
+	char *end;
+	unsigned long val = strtoul(s, &end, 10);
+
+	if (!*s || *end || strlen(s) > SERIAL_STR_LEN)
+		return -EINVAL;
+
+	*serial = val;
+	return 0;
+}
+
+static int do_cfgblock_generate(int argc, char *argv[])
+{
+	struct generate_ctx ctx;
+	char *args[4];
+	struct toradex_eth_addr mac;
+	char barcode[17];
+	u32 last;
+	int nargs = 0, bench = 0, ret = CMD_RET_SUCCESS;
+	long threads = parse_threads(NULL);
+	double secs;
+	struct stat st;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			threads = parse_threads(argv[++i]);
+		else if (!strcmp(argv[i], "--bench"))
+			bench = 1;
+		else if (nargs < ARRAY_SIZE(args))
+			args[nargs++] = argv[i];
+		else
+			nargs++;
+	}
+
+	if (nargs < 3 + !bench || nargs > 4 || threads < 1 ||
+	    strlen(args[0]) != 8 || strspn(args[0], "0123456789") != 8) {
+		printf("error: usage: generate [-j n] [--bench] "
+		       "<prodid+rev> <first> <last> [file|dir]\n");
+		return CMD_RET_USAGE;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	snprintf(barcode, sizeof(barcode), "%s00000000", args[0]);
+	if (get_cfgblock_barcode(TDX_EEPROM_ID_MODULE, barcode, &ctx.hw_tag,
+				 &ctx.first))
+		return CMD_RET_USAGE;
+
+	if (parse_serial(args[1], &ctx.first) || parse_serial(args[2], &last) ||
+	    last < ctx.first) {
+		printf("error: invalid serial range %s-%s.\n", args[1], args[2]);
+		return CMD_RET_USAGE;
+	}
+
+	/* The OUI index is the top byte, so checking the last serial is enough */
+	if (tdx_get_mac_from_serial(last, &mac)) {
+		printf("Can't find OUI for serial# %s\n", args[2]);
+		return CMD_RET_USAGE;
+	}
+
+	ctx.count = last - ctx.first + 1;
+	ctx.size = TDX_CFG_BLOCK_MAX_SIZE;
+	ctx.fd = -1;
+
+	/* Without an output, only the encoding is measured */
+	if (nargs == 4) {
+		if (!stat(args[3], &st) && S_ISDIR(st.st_mode)) {
+			ctx.dir = args[3];
+		} else {
+			ctx.fd = open(args[3], O_WRONLY | O_CREAT | O_TRUNC,
+				      0644);
+			if (ctx.fd == -1) {
+				printf("error: cannot open '%s': %s\n",
+				       args[3], strerror(errno));
+				return CMD_RET_FAILURE;
+			}
+		}
+	}
+
+	if (bench) {
+		int counts[] = { 1, 2, 4, threads };
+
+		for (int i = 0; i < ARRAY_SIZE(counts); i++) {
+			/* -j n (default: all CPUs) is only run when above 4 */
+			if (i == 3 && threads <= 4)
+				continue;
+
+			secs = generate_run(&ctx, counts[i]);
+			if (ctx.error)
+				break;
+			printf("threads=%d blocks=%u elapsed=%.3fs "
+			       "rate=%.0f/s\n", counts[i], ctx.count, secs,
+			       secs > 0 ? ctx.count / secs : 0);
+		}
+	} else {
+		secs = generate_run(&ctx, threads);
+		fprintf(stderr, "blocks=%u threads=%ld elapsed=%.3fs "
+			"rate=%.0f/s\n", ctx.count, threads, secs,
+			secs > 0 ? ctx.count / secs : 0);
+	}
+
+	if (ctx.error) {
+		printf("Failed to generate config blocks: %d\n", ctx.error);
+		ret = CMD_RET_FAILURE;
+	}
+
+	if (ctx.fd != -1 && close(ctx.fd)) {
+		printf("Failed to write '%s': %s\n", args[3], strerror(errno));
+		ret = CMD_RET_FAILURE;
+	}
+
+	return ret;
+}
+
+/*
+ * Apply one <field>=<value> assignment to the module or carrier part of data.
+ * Returns the TDX_WANT_* bit of the tag that has to be rewritten, or 0 if the
+ * assignment can't be parsed or holds a value create would refuse.
+ */
+static u32 set_tdx_field(u32 type, struct tdx_data *data,
+	const char *assignment)
+{
+	int module = type == TDX_EEPROM_ID_MODULE;
+	struct toradex_hw *hw = module ? &data->hw_tag : &data->car_hw_tag;
+	u32 hw_bit = module ? TDX_WANT_HW : TDX_WANT_CAR_HW;
+	const char *value = strchr(assignment, '=');
+	char name[TDX_FIELD_NAME_LEN];
+	char rev[MODULE_VER_STR_LEN + MODULE_REV_STR_LEN + 1];
+	unsigned long num;
+	char *end;
+
+	if (!value || !value[1] || value - assignment >= sizeof(name))
+		return 0;
+	memcpy(name, assignment, value - assignment);
+	name[value - assignment] = '\0';
+	value++;
+
+	if (!strcmp(name, "rev")) {
+		/* Same format as the interactive prompt: V1.1B or V1.1#26 */
+		if (value[0] == 'V')
+			value++;
+		if (strlen(value) < 4 || strlen(value) >= sizeof(rev) ||
+		    value[0] < '0' || value[0] > '9' || value[1] != '.' ||
+		    value[2] < '0' || value[2] > '9')
+			return 0;
+		strcpy(rev, value);
+		if (value[0] == '0' ||
+		    parse_assembly_string(rev, &hw->ver_assembly))
+			return 0;
+		hw->ver_major = value[0] - '0';
+		hw->ver_minor = value[2] - '0';
+		return hw_bit;
+	}
+
+	num = strtoul(value, &end, 10);
+	if (*end || num > 0xffffffffUL)
+		return 0;
+
+	if (!strcmp(name, "serial")) {
+		if (!module) {
+			data->car_serial = num;
+			return TDX_WANT_CAR_SERIAL;
+		}
+		data->serial = num;
+		if (tdx_get_mac_from_serial(data->serial, &data->eth_addr)) {
+			printf("Can't find OUI for this serial#\n");
+			return 0;
+		}
+		return TDX_WANT_MAC;
+	}
+
+	if (num > 0xffff)
+		return 0;
+
+	if (!strcmp(name, "prodid")) {
+		struct toradex_hw check = *hw;
+
+		/* Only the product id is checked, the version is set apart */
+		check.prodid = num;
+		if (tdx_barcode_check(type, &check, 0) == TDX_BARCODE_PRODID)
+			return 0;
+		hw->prodid = num;
+	} else if (!strcmp(name, "ver_major")) {
+		/* Hardware versions start at V1.0 */
+		if (!num)
+			return 0;
+		hw->ver_major = num;
+	} else if (!strcmp(name, "ver_minor")) {
+		hw->ver_minor = num;
+	} else if (!strcmp(name, "ver_assembly")) {
+		hw->ver_assembly = num;
+	} else {
+		return 0;
+	}
+
+	return hw_bit;
+}
+
+/*
+ * Update single fields of an existing config block. Each changed tag is
+ * patched in place and only the bytes between the first and the last patched
+ * payload byte are considered for writing. The block is re-encoded from
+ * scratch only when a tag that needs to change is missing.
+ */
+static int do_cfgblock_set(struct nv_handle *h, int argc, char *argv[])
+{
+	int module = h->dev->type == TDX_EEPROM_ID_MODULE;
+	size_t size = h->size;
+	struct nv_write_report report;
+	struct tdx_data data;
+	u8 old[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	u8 config_block[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	size_t avail, first = size, last = 0;
+	struct toradex_hw *hw = module ? &data.hw_tag : &data.car_hw_tag;
+	u32 changed = 0;
+	int offset, err, ret = CMD_RET_FAILURE;
+	struct {
+		u32 bit;
+		u16 id;
+		const void *payload;
+		size_t len;
+	} tags[] = {
+		{ TDX_WANT_HW, TDX_TAG_HW, &data.hw_tag, 8 },
+		{ TDX_WANT_MAC, TDX_TAG_MAC, &data.eth_addr, 6 },
+		{ TDX_WANT_CAR_HW, TDX_TAG_HW, &data.car_hw_tag, 8 },
+		{ TDX_WANT_CAR_SERIAL, TDX_TAG_CAR_SERIAL, &data.car_serial,
+		  sizeof(data.car_serial) },
+	};
+
+	if (size > sizeof(old))
+		goto out;
+
+	memset(&data, 0, sizeof(data));
+	if (fetch_tdx_cfg_block(h, old, size, tdx_data_want_all(h->dev->type),
+				&data, &avail)) {
+		printf("No valid Toradex %s config block, use create first\n",
+		       nv_dev_type_name[h->dev->type]);
+		goto out;
+	}
+
+	/*
+	 * The parser maps unknown module product ids to 0, take the hardware
+	 * tag as stored so that setting one field leaves the others alone.
+	 */
+	offset = tdx_find_tag(old, avail, size, TDX_TAG_HW, sizeof(*hw));
+	if (offset >= 0)
+		memcpy(hw, old + offset, sizeof(*hw));
+
+	for (int i = 0; i < argc; i++) {
+		u32 bit;
+
+		if (!strcmp(argv[i], "carrier") || !strcmp(argv[i], "display"))
+			continue;
+
+		bit = set_tdx_field(h->dev->type, &data, argv[i]);
+		if (!bit) {
+			printf("error: invalid assignment '%s'.\n", argv[i]);
+			ret = CMD_RET_USAGE;
+			goto out;
+		}
+		changed |= bit;
+	}
+
+	if (!changed) {
+		printf("error: nothing to set.\n");
+		ret = CMD_RET_USAGE;
+		goto out;
+	}
+
+	memcpy(config_block, old, size);
+	for (int i = 0; i < ARRAY_SIZE(tags); i++) {
+		if (!(changed & tags[i].bit))
+			continue;
+
+		offset = tdx_find_tag(old, avail, size, tags[i].id,
+				      tags[i].len);
+		if (offset < 0) {
+			/* Tag missing, fall back to a full re-encode */
+			if (module)
+				tdx_encode_cfg_block(config_block, size, &data);
+			else
+				tdx_encode_cfg_block_carrier(config_block, size,
+							     &data);
+			first = 0;
+			last = size;
+			break;
+		}
+
+		memcpy(config_block + offset, tags[i].payload, tags[i].len);
+		if (offset < first)
+			first = offset;
+		if (offset + tags[i].len > last)
+			last = offset + tags[i].len;
+	}
+
+	cfg_cache_invalidate(h);
+	/* Bytes past what was fetched are unknown, let the writer read them */
+	err = write_nv_device_data_diff(h, first, config_block + first,
+					last - first,
+					last <= avail ? old + first : NULL,
+					&report);
+	cfg_cache_invalidate(h);
+	if (err) {
+		printf("Failed to update Toradex %s config block\n",
+		       nv_dev_type_name[h->dev->type]);
+		goto out;
+	}
+
+	if (!report.pages)
+		printf("Toradex %s config block unchanged, nothing written\n",
+		       nv_dev_type_name[h->dev->type]);
+	else
+		printf("Toradex %s config block updated (%d/%d pages, %.1f ms)\n",
+		       nv_dev_type_name[h->dev->type], report.pages,
+		       report.pages_total, report.msecs);
+
+	ret = CMD_RET_SUCCESS;
+out:
+	return ret;
+}
+
+static void format_carrier_data(const char *prefix, const char *name,
+	const struct tdx_data *data, struct tdx_field *fields)
+{
+	char assembly[TDX_ASSEMBLY_STR_LEN];
+
+	snprintf(fields[0].name, sizeof(fields[0].name), "%s_prodid", prefix);
+	snprintf(fields[0].value, sizeof(fields[0].value),
+			"%04d", data->car_hw_tag.prodid);
+	snprintf(fields[1].name, sizeof(fields[1].name), "%s_prodname", prefix);
+	snprintf(fields[1].value, sizeof(fields[1].value), "%s", name);
+	snprintf(fields[2].name, sizeof(fields[2].name), "%s_rev", prefix);
+	snprintf(fields[2].value, sizeof(fields[2].value),
+			"V%1d.%1d%s",
+			data->car_hw_tag.ver_major,
+			data->car_hw_tag.ver_minor,
+			tdx_get_board_assembly_r(data->car_hw_tag.ver_assembly,
+						 assembly, sizeof(assembly)));
+	snprintf(fields[3].name, sizeof(fields[3].name), "%s_serial", prefix);
+	snprintf(fields[3].value, sizeof(fields[3].value),
+			"%08u", data->car_serial);
+}
+
+static void format_module_data(const struct tdx_data *data,
+	struct tdx_field *fields)
+{
+	char assembly[TDX_ASSEMBLY_STR_LEN];
+
+	strcpy(fields[0].name, "module_prodid");
+	snprintf(fields[0].value, sizeof(fields[0].value),
+			"%04d", data->hw_tag.prodid);
+	strcpy(fields[1].name, "module_prodname");
+	snprintf(fields[1].value, sizeof(fields[1].value),
+			"%s", toradex_modules[data->hw_tag.prodid].name);
+	strcpy(fields[2].name, "module_rev");
+	snprintf(fields[2].value, sizeof(fields[2].value),
+			"V%1d.%1d%s",
+			data->hw_tag.ver_major,
+			data->hw_tag.ver_minor,
+			tdx_get_board_assembly_r(data->hw_tag.ver_assembly,
+						 assembly, sizeof(assembly)));
+	strcpy(fields[3].name, "module_serial");
+	snprintf(fields[3].value, sizeof(fields[3].value),
+			"%08u", data->serial);
+}
+
+/* Fill TDX_FIELDS_PER_BLOCK key/value pairs describing a config block */
+static void format_tdx_data(u32 type, const struct tdx_data *data,
+	struct tdx_field *fields)
+{
+	switch (type) {
+	case TDX_EEPROM_ID_MODULE:
+		format_module_data(data, fields);
+		break;
+	case TDX_EEPROM_ID_CARRIER:
+		format_carrier_data("carrier",
+			tdx_get_carrier_boards(data->car_hw_tag.prodid),
+			data, fields);
+		break;
+	case TDX_EEPROM_ID_DISPLAY_ADAPTER:
+		format_carrier_data("display",
+			tdx_get_display_adapters(data->car_hw_tag.prodid),
+			data, fields);
+		break;
+	}
+}
+
+static void print_tdx_data(u32 type, const struct tdx_data *data)
+{
+	struct tdx_field fields[TDX_FIELDS_PER_BLOCK];
+	struct timespec start;
+
+	stats_start(&start);
+	format_tdx_data(type, data, fields);
+	for (int i = 0; i < TDX_FIELDS_PER_BLOCK; i++)
+		printf("%s=\"%s\"\n", fields[i].name, fields[i].value);
+	stats_stop(PHASE_FORMAT, &start);
+}
+
+static int do_cfgblock_print(struct nv_handle *h, const char *field)
+{
+	struct tdx_field fields[TDX_FIELDS_PER_BLOCK];
+	struct tdx_data data;
+	struct timespec start;
+	u32 want = tdx_data_want_all(h->dev->type);
+
+	if (field) {
+		want = tdx_field_want(h->dev->type, field);
+		if (!want) {
+			printf("error: unknown field '%s'.\n", field);
+			return CMD_RET_USAGE;
+		}
+	}
+
+	/* Tags missing from the block are formatted as zero, not stack garbage */
+	memset(&data, 0, sizeof(data));
+	int ret = load_tdx_data(h, want, &data);
+	if (ret == -ENOENT && field) {
+		printf("%s not present\n", field);
+		return CMD_RET_FAILURE;
+	}
+	if (ret) {
+		if (h->dev->type == TDX_EEPROM_ID_MODULE)
+			printf("Failed to load Toradex config block: %d\n",
+					ret);
+		else
+			printf("Failed to load Toradex %s config block: %d\n",
+					nv_dev_type_name[h->dev->type], ret);
+		return CMD_RET_FAILURE;
+	}
+
+	if (!field) {
+		print_tdx_data(h->dev->type, &data);
+		return CMD_RET_SUCCESS;
+	}
+
+	stats_start(&start);
+	format_tdx_data(h->dev->type, &data, fields);
+	for (int i = 0; i < TDX_FIELDS_PER_BLOCK; i++) {
+		if (!strcmp(fields[i].name, field))
+			printf("%s=\"%s\"\n", fields[i].name, fields[i].value);
+	}
+	stats_stop(PHASE_FORMAT, &start);
+
+	return CMD_RET_SUCCESS;
+}
+
+/*
+ * Index the whole block of h. Mapped images are indexed in place, anything
+ * else is read into buf; *block points at the indexed bytes.
+ */
+static int index_tdx_cfg_block(struct nv_handle *h, u8 *buf, size_t buf_size,
+	const u8 **block, struct tdx_tlv_index *index)
+{
+	struct timespec start;
+	int ret;
+
+	if (h->map) {
+		*block = h->map;
+	} else {
+		if (h->size > buf_size)
+			return -EINVAL;
+		ret = read_nv_device_data(h, 0, buf, h->size);
+		if (ret)
+			return ret;
+		*block = buf;
+	}
+
+	stats_start(&start);
+	ret = tdx_tlv_index_build(*block, h->size, index);
+	stats_stop(PHASE_PARSE, &start);
+	if (ret == -E2BIG)
+		printf("warning: more than %d tags, only the first are shown\n",
+		       TDX_TLV_INDEX_MAX);
+
+	return ret == -E2BIG ? 0 : ret;
+}
+
+static const char *tdx_tag_name(u16 id)
+{
+	switch (id) {
+	case TDX_TAG_MAC:
+		return "mac";
+	case TDX_TAG_HW:
+		return "hw";
+	case TDX_TAG_CAR_SERIAL:
+		return "car_serial";
+	default:
+		return "unknown";
+	}
+}
+
+/* Print every tag of the block, including unknown and invalid ones */
+static int do_cfgblock_dump(struct nv_handle *h)
+{
+	u8 buf[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	struct tdx_tlv_index index;
+	const u8 *block;
+	int ret;
+
+	ret = index_tdx_cfg_block(h, buf, sizeof(buf), &block, &index);
+	if (ret) {
+		printf("No valid Toradex %s config block: %d\n",
+		       nv_dev_type_name[h->dev->type], ret);
+		return CMD_RET_FAILURE;
+	}
+
+	for (unsigned int i = 0; i < index.count; i++) {
+		const struct tdx_tlv_entry *entry = &index.tags[i];
+
+		printf("tag=0x%04x name=%s flags=%u offset=%u len=%u data=",
+		       entry->id, entry->flags == TDX_TAG_FLAG_VALID ?
+		       tdx_tag_name(entry->id) : "invalid", entry->flags,
+		       entry->offset, entry->len);
+		for (unsigned int j = 0; j < entry->len; j++)
+			printf("%02x", block[entry->offset + j]);
+		printf("\n");
+	}
+
+	return CMD_RET_SUCCESS;
+}
+
+/* Print the payload of one tag, as hex or as raw bytes with --binary */
+static int do_cfgblock_get(struct nv_handle *h, int argc, char *argv[])
+{
+	u8 buf[TDX_CFG_BLOCK_BUF_SIZE] __aligned_dma;
+	const struct tdx_tlv_entry *entry;
+	struct tdx_tlv_index index;
+	const char *id_str = NULL;
+	const u8 *block;
+	unsigned long id;
+	int binary = 0;
+	char *end;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "carrier") || !strcmp(argv[i], "display"))
+			continue;
+		else if (!strcmp(argv[i], "--binary"))
+			binary = 1;
+		else
+			id_str = argv[i];
+	}
+
+	if (!id_str) {
+		printf("error: usage: get [carrier|display] [--binary] "
+		       "<tag-id>\n");
+		return CMD_RET_USAGE;
+	}
+
+	id = strtoul(id_str, &end, 0);
+	if (*end || id > 0xffff) {
+		printf("error: invalid tag id '%s'.\n", id_str);
+		return CMD_RET_USAGE;
+	}
+
+	if (index_tdx_cfg_block(h, buf, sizeof(buf), &block, &index)) {
+		printf("No valid Toradex %s config block\n",
+		       nv_dev_type_name[h->dev->type]);
+		return CMD_RET_FAILURE;
+	}
+
+	entry = tdx_tlv_lookup(&index, id);
+	if (!entry) {
+		printf("error: tag 0x%04lx not found.\n", id);
+		return CMD_RET_FAILURE;
+	}
+
+	if (binary) {
+		fwrite(block + entry->offset, 1, entry->len, stdout);
+		return CMD_RET_SUCCESS;
+	}
+
+	for (unsigned int i = 0; i < entry->len; i++)
+		printf("%02x", block[entry->offset + i]);
+	printf("\n");
+
+	return CMD_RET_SUCCESS;
+}
+
+struct cfgblock_job {
+	const struct non_volatile_device *nv_dev;
+	struct tdx_data data;
+	pthread_t thread;
+	int started;
+	int ret;
+};
+
+static void *cfgblock_job_read(void *arg)
+{
+	struct cfgblock_job *job = arg;
+	struct nv_handle h;
+
+	job->ret = nv_open(&h, job->nv_dev, O_RDONLY);
+	if (job->ret)
+		return NULL;
+
+	job->ret = load_tdx_data(&h, tdx_data_want_all(job->nv_dev->type),
+				 &job->data);
+	nv_close(&h);
+
+	return NULL;
+}
+
+/* Read and parse all jobs in one nv_read_blocks_batched() batch */
+static int cfgblock_jobs_batched(struct cfgblock_job *jobs, unsigned int count)
+{
+	struct nv_read_req *reqs;
+	int ret;
+
+	reqs = calloc(count, sizeof(*reqs));
+	if (!reqs)
+		return -ENOMEM;
+
+	for (unsigned int i = 0; i < count; i++) {
+		reqs[i].dev = *jobs[i].nv_dev;
+		reqs[i].want = tdx_data_want_all(reqs[i].dev.type);
+	}
+
+	ret = nv_read_blocks_batched(reqs, count);
+	for (unsigned int i = 0; !ret && i < count; i++) {
+		jobs[i].ret = reqs[i].ret;
+		jobs[i].data = reqs[i].data;
+	}
+
+	free(reqs);
+
+	return ret;
+}
+
+/*
+ * Read every candidate device at once, one thread each, so that module,
+ * carrier and display adapter EEPROMs sitting on different buses are read in
+ * parallel. Per type, the first candidate in nv_table[] order holding a valid
+ * block wins, which matches what first_valid_nv_dev() would have picked.
+ * Without the cache the devices are read in one io_uring batch instead.
+ * Returns the number of config blocks found.
+ */
+static int load_all_tdx_data(struct tdx_data data[TDX_EEPROM_ID_COUNT],
+	int valid[TDX_EEPROM_ID_COUNT])
+{
+	struct cfgblock_job jobs[TDX_CFG_DEVICES_MAX];
+	unsigned int count;
+	int found = 0;
+
+	nv_table_load(0);
+	count = nv_table_count;
+
+	memset(jobs, 0, sizeof(jobs));
+	memset(valid, 0, TDX_EEPROM_ID_COUNT * sizeof(*valid));
+
+	for (unsigned int i = 0; i < count; i++)
+		jobs[i].nv_dev = &nv_table[i];
+
+	/* The cache needs per device handles, so it stays with the threads */
+	if (use_cache || cfgblock_jobs_batched(jobs, count)) {
+		for (unsigned int i = 0; i < count; i++) {
+			if (!pthread_create(&jobs[i].thread, NULL,
+					    cfgblock_job_read, &jobs[i]))
+				jobs[i].started = 1;
+			else
+				cfgblock_job_read(&jobs[i]);
+		}
+
+		for (unsigned int i = 0; i < count; i++) {
+			if (jobs[i].started)
+				pthread_join(jobs[i].thread, NULL);
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		u32 type = jobs[i].nv_dev->type;
+
+		if (jobs[i].ret || valid[type])
+			continue;
+
+		memcpy(&data[type], &jobs[i].data, sizeof(data[type]));
+		valid[type] = 1;
+		found++;
+	}
+
+	return found;
+}
+
+static int do_cfgblock_print_all(void)
+{
+	struct tdx_data data[TDX_EEPROM_ID_COUNT];
+	int valid[TDX_EEPROM_ID_COUNT];
+
+	if (!load_all_tdx_data(data, valid)) {
+		printf("Failed to load any Toradex config block\n");
+		return CMD_RET_FAILURE;
+	}
+
+	for (u32 type = 0; type < TDX_EEPROM_ID_COUNT; type++) {
+		if (valid[type])
+			print_tdx_data(type, &data[type]);
+	}
+
+	return CMD_RET_SUCCESS;
+}
+
+/*
+ * Fleet scanner: decode raw config block dumps, one per file or concatenated
+ * at a fixed stride, with the same parser used for the devices. Inputs are
+ * mmap'd and split into work units (a whole file, or a range of blocks of a
+ * large file given on the command line) that the worker threads pull from a
+ * shared atomic cursor. Rows are buffered per worker and streamed to stdout
+ * as JSON Lines or CSV, in completion order.
+ */
+#define TDX_CFG_SCAN_CHUNK	4096
+#define TDX_CFG_SCAN_BUF	65536
+#define TDX_CFG_SCAN_BATCH	256
+
+struct scan_unit {
+	const char *path;
+	off_t first;		/* first block */
+	off_t count;		/* number of blocks, 0 for the whole file */
+};
+
+struct scan_ctx {
+	u32 type;
+	size_t stride;
+	int impl;
+	int csv;
+	struct scan_unit *units;
+	size_t nunits;
+	size_t units_size;
+	size_t next;
+	pthread_mutex_t out_lock;
+	unsigned long files;
+	unsigned long blocks;
+	unsigned long valid;
+	unsigned long failed;
+};
+
+struct scan_out {
+	struct scan_ctx *ctx;
+	size_t len;
+	char buf[TDX_CFG_SCAN_BUF];
+};
+
+static void scan_flush(struct scan_out *out)
+{
+	pthread_mutex_lock(&out->ctx->out_lock);
+	fwrite(out->buf, 1, out->len, stdout);
+	pthread_mutex_unlock(&out->ctx->out_lock);
+	out->len = 0;
+}
+
+static void scan_printf(struct scan_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	for (int retry = 0; retry < 2; retry++) {
+		va_start(ap, fmt);
+		len = vsnprintf(out->buf + out->len,
+				sizeof(out->buf) - out->len, fmt, ap);
+		va_end(ap);
+
+		if (len < 0)
+			return;
+		if (out->len + len < sizeof(out->buf)) {
+			out->len += len;
+			return;
+		}
+		scan_flush(out);
+	}
+}
+
+/* Append s quoted for JSON, or for CSV */
+static void scan_quote(struct scan_out *out, const char *s)
+{
+	size_t len = strlen(s);
+	char *p;
+
+	/* Worst case every character becomes a \u00XX escape */
+	if (out->len + 6 * len + 2 >= sizeof(out->buf))
+		scan_flush(out);
+	if (6 * len + 2 >= sizeof(out->buf))
+		return;
+
+	p = out->buf + out->len;
+	*p++ = '"';
+	for (; *s; s++) {
+		if (out->ctx->csv) {
+			if (*s == '"')
+				*p++ = '"';
+		} else if (*s == '"' || *s == '\\') {
+			*p++ = '\\';
+		} else if ((unsigned char)*s < 0x20) {
+			p += sprintf(p, "\\u%04x", *s);
+			continue;
+		}
+		*p++ = *s;
+	}
+	*p++ = '"';
+	out->len = p - out->buf;
+}
+
+static void scan_block(struct scan_out *out, const char *path, off_t offset,
+	const struct tdx_data *data, int ret)
+{
+	struct scan_ctx *ctx = out->ctx;
+	struct tdx_field fields[TDX_FIELDS_PER_BLOCK];
+	char mac[18] = "";
+
+	if (!ctx->csv) {
+		scan_printf(out, "{\"file\":");
+		scan_quote(out, path);
+		scan_printf(out, ",\"offset\":%lld,\"valid\":%s",
+			    (long long)offset, ret ? "false" : "true");
+	} else {
+		scan_quote(out, path);
+		scan_printf(out, ",%lld,%d", (long long)offset, !ret);
+	}
+
+	if (ret) {
+		scan_printf(out, ctx->csv ? ",,,,,\n" : ",\"error\":%d}\n",
+			    ret);
+		return;
+	}
+
+	format_tdx_data(ctx->type, data, fields);
+	if (ctx->type == TDX_EEPROM_ID_MODULE) {
+		const u8 *a = (const u8 *)&data->eth_addr;
+
+		snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+			 a[0], a[1], a[2], a[3], a[4], a[5]);
+	}
+
+	for (int i = 0; i < TDX_FIELDS_PER_BLOCK; i++) {
+		/* Field names without the module_/carrier_ prefix */
+		const char *name = strchr(fields[i].name, '_') + 1;
+
+		if (ctx->csv)
+			scan_printf(out, ",");
+		else
+			scan_printf(out, ",\"%s\":", name);
+		scan_quote(out, fields[i].value);
+	}
+
+	if (ctx->csv)
+		scan_printf(out, ",%s\n", mac);
+	else
+		scan_printf(out, ",\"mac\":\"%s\"}\n", mac);
+}
+
+static void scan_unit(struct scan_out *out, const struct scan_unit *unit,
+	unsigned long *blocks, unsigned long *valid, unsigned long *failed)
+{
+	struct scan_ctx *ctx = out->ctx;
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t start, end, map_start;
+	struct stat st;
+	u8 *map;
+	int fd;
+
+	fd = open(unit->path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", unit->path,
+			strerror(errno));
+		(*failed)++;
+		goto out;
+	}
+
+	start = unit->first * ctx->stride;
+	end = unit->count ? start + unit->count * ctx->stride : st.st_size;
+	if (end > st.st_size)
+		end = st.st_size;
+	if (start >= end)
+		goto out;
+
+	map_start = start & ~(page - 1);
+	map = mmap(NULL, end - map_start, PROT_READ, MAP_PRIVATE, fd,
+		   map_start);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map '%s': %s\n", unit->path,
+			strerror(errno));
+		(*failed)++;
+		goto out;
+	}
+	madvise(map, end - map_start, MADV_SEQUENTIAL);
+
+	/* Complete blocks are decoded in batches, a short tail on its own */
+	for (off_t offset = start; offset < end;) {
+		struct tdx_data data[TDX_CFG_SCAN_BATCH];
+		int ret[TDX_CFG_SCAN_BATCH];
+		size_t n = (end - offset) / ctx->stride;
+
+		if (n > TDX_CFG_SCAN_BATCH)
+			n = TDX_CFG_SCAN_BATCH;
+
+		if (n) {
+			*valid += tdx_decode_cfg_blocks(ctx->impl,
+					map + (offset - map_start),
+					ctx->stride, n, ctx->type, data, ret);
+		} else {
+			size_t need;
+
+			n = 1;
+			memset(data, 0, sizeof(data[0]));
+			ret[0] = tdx_parse_cfg_block(map + (offset - map_start),
+					end - offset, ctx->stride,
+					tdx_data_want_all(ctx->type), data,
+					&need);
+			*valid += !ret[0];
+		}
+
+		for (size_t i = 0; i < n; i++)
+			scan_block(out, unit->path, offset + i * ctx->stride,
+				   &data[i], ret[i]);
+
+		*blocks += n;
+		offset += n * ctx->stride;
+	}
+
+	munmap(map, end - map_start);
+out:
+	if (fd != -1)
+		close(fd);
+}
+
+static void *scan_worker(void *arg)
+{
+	struct scan_ctx *ctx = arg;
+	unsigned long blocks = 0, valid = 0, failed = 0;
+	struct scan_out *out;
+
+	out = malloc(sizeof(*out));
+	if (!out)
+		return NULL;
+	out->ctx = ctx;
+	out->len = 0;
+
+	for (;;) {
+		size_t i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+
+		if (i >= ctx->nunits)
+			break;
+		scan_unit(out, &ctx->units[i], &blocks, &valid, &failed);
+	}
+
+	scan_flush(out);
+	free(out);
+
+	__atomic_fetch_add(&ctx->blocks, blocks, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ctx->valid, valid, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ctx->failed, failed, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+static int scan_add_unit(struct scan_ctx *ctx, const char *path, off_t first,
+	off_t count)
+{
+	if (ctx->nunits == ctx->units_size) {
+		size_t size = ctx->units_size ? 2 * ctx->units_size : 1024;
+		struct scan_unit *units;
+
+		units = realloc(ctx->units, size * sizeof(*units));
+		if (!units)
+			return -ENOMEM;
+		ctx->units = units;
+		ctx->units_size = size;
+	}
+
+	ctx->units[ctx->nunits].path = path;
+	ctx->units[ctx->nunits].first = first;
+	ctx->units[ctx->nunits].count = count;
+	ctx->nunits++;
+
+	return 0;
+}
+
+/* Queue every regular file below dir, one unit each */
+static int scan_add_dir(struct scan_ctx *ctx, const char *dir)
+{
+	struct dirent *de;
+	DIR *d;
+	int ret = 0;
+
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", dir,
+			strerror(errno));
+		return -errno;
+	}
+
+	while (!ret && (de = readdir(d))) {
+		struct stat st;
+		char *path;
+		int type = de->d_type;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (asprintf(&path, "%s/%s", dir, de->d_name) < 0) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (type == DT_UNKNOWN || type == DT_LNK) {
+			type = DT_UNKNOWN;
+			if (!stat(path, &st))
+				type = S_ISDIR(st.st_mode) ? DT_DIR :
+				       S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if (type == DT_DIR) {
+			ret = scan_add_dir(ctx, path);
+			free(path);
+		} else if (type == DT_REG) {
+			ctx->files++;
+			ret = scan_add_unit(ctx, path, 0, 0);
+		} else {
+			free(path);
+		}
+	}
+
+	closedir(d);
+	return ret;
+}
+
+/* Queue a file or directory given on the command line */
+static int scan_add_input(struct scan_ctx *ctx, const char *input)
+{
+	struct stat st;
+	off_t blocks;
+	char *path;
+	int ret = 0;
+
+	if (stat(input, &st)) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", input,
+			strerror(errno));
+		return -errno;
+	}
+
+	if (S_ISDIR(st.st_mode))
+		return scan_add_dir(ctx, input);
+
+	/* Large concatenated dumps are split so all workers share them */
+	ctx->files++;
+	blocks = (st.st_size + ctx->stride - 1) / ctx->stride;
+	if (!blocks)
+		return 0;
+
+	path = strdup(input);
+	if (!path)
+		return -ENOMEM;
+
+	for (off_t first = 0; !ret && first < blocks;
+	     first += TDX_CFG_SCAN_CHUNK)
+		ret = scan_add_unit(ctx, path, first, TDX_CFG_SCAN_CHUNK);
+
+	return ret;
+}
+
+static int do_cfgblock_scan(int argc, char *argv[])
+{
+	struct scan_ctx ctx;
+	struct timespec start;
+	long threads = parse_threads(NULL);
+	int ninputs = 0, ret = CMD_RET_SUCCESS;
+	double secs;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.type = TDX_EEPROM_ID_MODULE;
+	ctx.impl = tdx_tlv_best_impl();
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			threads = parse_threads(argv[++i]);
+		} else if (!strcmp(argv[i], "--csv")) {
+			ctx.csv = 1;
+		} else if (!strcmp(argv[i], "--stride") && i + 1 < argc) {
+			ctx.stride = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+			int type = tdx_type_from_name(argv[++i]);
+
+			if (type < 0) {
+				printf("error: unknown block type '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+			ctx.type = type;
+		} else {
+			argv[ninputs++] = argv[i];
+		}
+	}
+
+	if (!ctx.stride)
+		ctx.stride = ctx.type == TDX_EEPROM_ID_MODULE ?
+			     TDX_CFG_BLOCK_MAX_SIZE :
+			     TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
+
+	if (!ninputs || threads < 1 || ctx.stride < 8) {
+		printf("error: usage: scan [-j n] [--csv] [--type t] "
+		       "[--stride n] <dir|file>...\n");
+		return CMD_RET_USAGE;
+	}
+
+	for (int i = 0; i < ninputs; i++) {
+		if (scan_add_input(&ctx, argv[i]))
+			ret = CMD_RET_FAILURE;
+	}
+
+	if (ctx.csv)
+		printf("file,offset,valid,prodid,prodname,rev,serial,mac\n");
+	fflush(stdout);
+
+	pthread_mutex_init(&ctx.out_lock, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	run_workers(threads, scan_worker, &ctx);
+
+	fflush(stdout);
+	secs = elapsed_ms(&start) / 1e3;
+	fprintf(stderr, "files=%lu blocks=%lu valid=%lu errors=%lu "
+		"elapsed=%.3fs rate=%.0f/s\n", ctx.files, ctx.blocks,
+		ctx.valid, ctx.failed, secs, secs > 0 ? ctx.blocks / secs : 0);
+
+	/* Unit paths are owned by the first unit of every file */
+	for (size_t i = 0; i < ctx.nunits; i++) {
+		if (!ctx.units[i].first)
+			free((char *)ctx.units[i].path);
+	}
+	free(ctx.units);
+	pthread_mutex_destroy(&ctx.out_lock);
+
+	return ctx.failed ? CMD_RET_FAILURE : ret;
+}
+
+/*
+ * validate-barcodes checks order sheets with one barcode per line before a
+ * production run. Files are streamed through one large buffer and every line
+ * goes through the strict library decoder, so only bad lines cost a printf.
+ */
+#define TDX_CFG_VALIDATE_BUF	(1 << 20)
+
+struct validate_ctx {
+	u32 type;
+	char *buf;
+	unsigned long files;
+	unsigned long barcodes;
+	unsigned long invalid;
+};
+
+static void validate_barcode_line(struct validate_ctx *ctx, const char *name,
+				  unsigned long lineno, const char *line,
+				  size_t len)
+{
+	struct toradex_hw hw;
+	u32 serial;
+	int err;
+
+	while (len && (line[len - 1] == '\r' || line[len - 1] == ' ' ||
+		       line[len - 1] == '\t'))
+		len--;
+	while (len && (*line == ' ' || *line == '\t')) {
+		line++;
+		len--;
+	}
+	if (!len)
+		return;
+
+	ctx->barcodes++;
+	err = tdx_barcode_decode(line, len, &hw, &serial);
+	if (!err)
+		err = tdx_barcode_check(ctx->type, &hw, serial);
+	if (!err)
+		return;
+
+	ctx->invalid++;
+	printf("%s:%lu: %s: '%.*s'%s\n", name, lineno, tdx_barcode_error[err],
+	       len > 32 ? 32 : (int)len, line, len > 32 ? "..." : "");
+}
+
+static int validate_barcode_file(struct validate_ctx *ctx, int fd,
+				 const char *name)
+{
+	unsigned long lineno = 0;
+	size_t have = 0;
+	int overlong = 0;
+	ssize_t n;
+
+	do {
+		char *p = ctx->buf, *end, *nl;
+
+		n = read(fd, ctx->buf + have, TDX_CFG_VALIDATE_BUF - have);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			printf("error: cannot read '%s': %s.\n", name,
+			       strerror(errno));
+			return -errno;
+		}
+		end = ctx->buf + have + n;
+
+		/* At the end of the file, the last line may lack its newline */
+		while ((nl = memchr(p, '\n', end - p)) || (!n && p < end)) {
+			lineno++;
+			if (overlong)
+				overlong = 0;
+			else
+				validate_barcode_line(ctx, name, lineno, p,
+						      (nl ? nl : end) - p);
+			p = nl ? nl + 1 : end;
+		}
+
+		/* Carry the partial last line over, a full buffer is garbage */
+		have = p < end ? end - p : 0;
+		if (have == TDX_CFG_VALIDATE_BUF) {
+			if (!overlong)
+				validate_barcode_line(ctx, name, lineno + 1, p,
+						      have);
+			overlong = 1;
+			have = 0;
+		}
+		memmove(ctx->buf, p, have);
+	} while (n);
+
+	ctx->files++;
+	return 0;
+}
+
+static int do_cfgblock_validate_barcodes(int argc, char *argv[])
+{
+	struct validate_ctx ctx;
+	struct timespec start;
+	int ninputs = 0, ret = CMD_RET_SUCCESS;
+	double secs;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.type = TDX_EEPROM_ID_MODULE;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+			int type = tdx_type_from_name(argv[++i]);
+
+			if (type < 0) {
+				printf("error: unknown block type '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+			ctx.type = type;
+		} else if (!strncmp(argv[i], "--", 2)) {
+			printf("error: usage: validate-barcodes [--type t] "
+			       "[file...]\n");
+			return CMD_RET_USAGE;
+		} else {
+			argv[ninputs++] = argv[i];
+		}
+	}
+
+	ctx.buf = malloc(TDX_CFG_VALIDATE_BUF);
+	if (!ctx.buf) {
+		printf("error: out of memory.\n");
+		return CMD_RET_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!ninputs && validate_barcode_file(&ctx, STDIN_FILENO, "<stdin>"))
+		ret = CMD_RET_FAILURE;
+
+	for (int i = 0; i < ninputs; i++) {
+		int fd = open(argv[i], O_RDONLY);
+
+		if (fd < 0) {
+			printf("error: cannot open '%s': %s.\n", argv[i],
+			       strerror(errno));
+			ret = CMD_RET_FAILURE;
+			continue;
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		if (validate_barcode_file(&ctx, fd, argv[i]))
+			ret = CMD_RET_FAILURE;
+		close(fd);
+	}
+
+	fflush(stdout);
+	secs = elapsed_ms(&start) / 1e3;
+	fprintf(stderr, "files=%lu barcodes=%lu invalid=%lu elapsed=%.3fs "
+		"rate=%.0f/s\n", ctx.files, ctx.barcodes, ctx.invalid, secs,
+		secs > 0 ? ctx.barcodes / secs : 0);
+
+	free(ctx.buf);
+	return ctx.invalid ? CMD_RET_FAILURE : ret;
+}
+
+/*
+ * dedup looks for serial numbers, and so MAC addresses, used more than once
+ * across config block dumps, barcode lists and scan output. Records are
+ * hashed into partitions, kept in memory up to --mem and spilled to unlinked
+ * temporary files beyond that. Every partition is then checked on its own
+ * with an open addressing hash set, so memory stays bounded by --mem plus one
+ * partition per thread however many records there are.
+ */
+#define TDX_CFG_DEDUP_PARTS	256
+#define TDX_CFG_DEDUP_LOCAL	256		/* per worker and partition */
+#define TDX_CFG_DEDUP_CHUNK	(8 << 20)	/* text bytes per unit */
+#define TDX_CFG_DEDUP_MEM	512		/* default --mem in MiB */
+#define TDX_CFG_DEDUP_NONE	UINT32_MAX
+
+enum {
+	DEDUP_AUTO,
+	DEDUP_BLOCKS,
+	DEDUP_BARCODES,
+	DEDUP_SCAN,
+	DEDUP_FORMAT_COUNT,
+};
+
+static const char * const dedup_format_name[DEDUP_FORMAT_COUNT] = {
+	[DEDUP_AUTO]		= "auto",
+	[DEDUP_BLOCKS]		= "blocks",
+	[DEDUP_BARCODES]	= "barcodes",
+	[DEDUP_SCAN]		= "scan",
+};
+
+struct dedup_rec {
+	uint64_t key;		/* type << 48 | MAC, or type << 48 | serial */
+	u32 unit;
+	u32 index;		/* line or block within the unit */
+};
+
+struct dedup_unit {
+	const char *path;	/* owned by the unit starting at 0 */
+	int format;
+	off_t start;		/* bytes */
+	off_t end;		/* bytes, 0 for the end of the file */
+	u32 count;		/* lines or blocks starting in the unit */
+	uint64_t base;		/* lines in the units before, same file */
+};
+
+struct dedup_part {
+	pthread_mutex_t lock;
+	struct dedup_rec *recs;
+	size_t n;
+	size_t size;
+	int fd;			/* spill file, -1 until needed */
+	size_t spilled;
+};
+
+struct dedup_ctx {
+	u32 type;
+	size_t stride;
+	int format;
+	int impl;
+	const char *tmpdir;
+	size_t mem_max;		/* records kept in memory */
+	size_t mem_used;
+	struct dedup_unit *units;
+	size_t nunits;
+	size_t units_size;
+	size_t next;
+	struct dedup_part parts[TDX_CFG_DEDUP_PARTS];
+	pthread_mutex_t out_lock;
+	unsigned long files;
+	unsigned long records;
+	unsigned long invalid;
+	unsigned long failed;
+	unsigned long spilled;
+	unsigned long groups;
+	unsigned long dups;
+};
+
+struct dedup_worker {
+	struct dedup_ctx *ctx;
+	unsigned long records;
+	unsigned long invalid;
+	unsigned long failed;
+	size_t len;
+	char out[TDX_CFG_SCAN_BUF];
+	u32 n[TDX_CFG_DEDUP_PARTS];
+	struct dedup_rec buf[TDX_CFG_DEDUP_PARTS][TDX_CFG_DEDUP_LOCAL];
+};
+
+/* 64 bit finalizer of MurmurHash3, partitions use the top bits */
+static uint64_t dedup_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+static uint64_t dedup_mac_key(const struct toradex_eth_addr *eth_addr)
+{
+	const u8 *a = (const u8 *)eth_addr;
+	uint64_t key = (uint64_t)TDX_EEPROM_ID_MODULE << 48;
+
+	for (int i = 0; i < 6; i++)
+		key |= (uint64_t)a[i] << (40 - 8 * i);
+	return key;
+}
+
+/* Module serials stand for the MAC tdx_get_mac_from_serial() gives them */
+static uint64_t dedup_serial_key(u32 type, u32 serial)
+{
+	struct toradex_eth_addr eth_addr;
+
+	if (type != TDX_EEPROM_ID_MODULE)
+		return (uint64_t)type << 48 | serial;
+
+	tdx_get_mac_from_serial(serial, &eth_addr);
+	return dedup_mac_key(&eth_addr);
+}
+
+static void dedup_out_flush(struct dedup_worker *w)
+{
+	pthread_mutex_lock(&w->ctx->out_lock);
+	fwrite(w->out, 1, w->len, stdout);
+	pthread_mutex_unlock(&w->ctx->out_lock);
+	w->len = 0;
+}
+
+static void dedup_printf(struct dedup_worker *w, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	for (int retry = 0; retry < 2; retry++) {
+		va_start(ap, fmt);
+		len = vsnprintf(w->out + w->len, sizeof(w->out) - w->len, fmt,
+				ap);
+		va_end(ap);
+
+		if (len < 0)
+			return;
+		if (w->len + len < sizeof(w->out)) {
+			w->len += len;
+			return;
+		}
+		dedup_out_flush(w);
+	}
+}
+
+static int dedup_spill(struct dedup_ctx *ctx, struct dedup_part *part,
+	const struct dedup_rec *recs, size_t n)
+{
+	const char *p = (const char *)recs;
+	size_t len = n * sizeof(*recs);
+	ssize_t ret;
+
+	if (part->fd < 0) {
+		char path[PATH_MAX];
+
+		snprintf(path, sizeof(path), "%s/tdx-cfgblock-dedup-XXXXXX",
+			 ctx->tmpdir);
+		part->fd = mkstemp(path);
+		if (part->fd < 0) {
+			fprintf(stderr, "error: cannot create '%s': %s\n",
+				path, strerror(errno));
+			return -errno;
+		}
+		unlink(path);
+	}
+
+	while (len) {
+		ret = write(part->fd, p, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			fprintf(stderr, "error: cannot spill records: %s\n",
+				ret ? strerror(errno) : "short write");
+			return ret ? -errno : -EIO;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	part->spilled += n;
+	__atomic_fetch_add(&ctx->spilled, n, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Move a worker's records of partition p to memory, or to disk when full */
+static void dedup_flush(struct dedup_worker *w, unsigned int p)
+{
+	struct dedup_ctx *ctx = w->ctx;
+	struct dedup_part *part = &ctx->parts[p];
+	size_t n = w->n[p];
+	int in_mem = 0;
+
+	pthread_mutex_lock(&part->lock);
+	if (__atomic_add_fetch(&ctx->mem_used, n, __ATOMIC_RELAXED) <=
+	    ctx->mem_max) {
+		if (part->n + n > part->size) {
+			size_t size = part->size ? 2 * part->size : 4096;
+			struct dedup_rec *recs;
+
+			recs = realloc(part->recs, size * sizeof(*recs));
+			if (recs) {
+				part->recs = recs;
+				part->size = size;
+			}
+		}
+		in_mem = part->n + n <= part->size;
+	}
+
+	if (in_mem) {
+		memcpy(part->recs + part->n, w->buf[p], n * sizeof(w->buf[p][0]));
+		part->n += n;
+	} else {
+		__atomic_sub_fetch(&ctx->mem_used, n, __ATOMIC_RELAXED);
+		if (dedup_spill(ctx, part, w->buf[p], n))
+			w->failed++;
+	}
+	pthread_mutex_unlock(&part->lock);
+
+	w->n[p] = 0;
+}
+
+static void dedup_add(struct dedup_worker *w, uint64_t key, u32 unit,
+	u32 index)
+{
+	unsigned int p = dedup_hash(key) >> 56;
+	struct dedup_rec *rec = &w->buf[p][w->n[p]++];
+
+	rec->key = key;
+	rec->unit = unit;
+	rec->index = index;
+	w->records++;
+
+	if (w->n[p] == TDX_CFG_DEDUP_LOCAL)
+		dedup_flush(w, p);
+}
+
+static int dedup_parse_serial(const char *s, size_t len, u32 *serial)
+{
+	u32 val = 0;
+
+	if (!len || len > SERIAL_STR_LEN)
+		return -EINVAL;
+
+	for (size_t i = 0; i < len; i++) {
+		if (s[i] < '0' || s[i] > '9')
+			return -EINVAL;
+		val = val * 10 + s[i] - '0';
+	}
+
+	*serial = val;
+	return 0;
+}
+
+/* "xx:xx:xx:xx:xx:xx" of len characters */
+static int parse_eth_addr(const char *s, size_t len,
+	struct toradex_eth_addr *eth_addr)
+{
+	u8 *a = (u8 *)eth_addr;
+
+	if (len != 17)
+		return -EINVAL;
+
+	for (int i = 0; i < 6; i++) {
+		const char *p = s + 3 * i;
+
+		if (!isxdigit((unsigned char)p[0]) ||
+		    !isxdigit((unsigned char)p[1]) ||
+		    (i < 5 && p[2] != ':'))
+			return -EINVAL;
+		a[i] = strtoul((char []){ p[0], p[1], '\0' }, NULL, 16);
+	}
+
+	return 0;
+}
+
+static int dedup_parse_mac(const char *s, size_t len, uint64_t *key)
+{
+	struct toradex_eth_addr eth_addr;
+
+	if (parse_eth_addr(s, len, &eth_addr))
+		return -EINVAL;
+
+	*key = dedup_mac_key(&eth_addr);
+	return 0;
+}
+
+/* Value of "name":"value" in a JSON line, as written by scan */
+static const char *dedup_json_field(const char *line, size_t len,
+	const char *name, size_t *value_len)
+{
+	char pattern[32];
+	const char *p, *end = line + len;
+	size_t n;
+
+	n = snprintf(pattern, sizeof(pattern), "\"%s\":\"", name);
+	p = memmem(line, len, pattern, n);
+	if (!p)
+		return NULL;
+	p += n;
+
+	*value_len = 0;
+	while (p + *value_len < end && p[*value_len] != '"')
+		(*value_len)++;
+	return p;
+}
+
+/*
+ * Key of one line of a barcode list or of scan output. Returns -ENOENT for
+ * lines without a record (blank lines, the CSV header) and -EINVAL for bad
+ * ones. Scan output of modules is keyed on the MAC actually found.
+ */
+static int dedup_line(struct dedup_ctx *ctx, int format, const char *line,
+	size_t len, uint64_t *key)
+{
+	const char *serial, *mac = NULL;
+	size_t serial_len, mac_len = 0;
+	struct toradex_hw hw;
+	u32 val;
+
+	while (len && (line[len - 1] == '\r' || line[len - 1] == ' ' ||
+		       line[len - 1] == '\t'))
+		len--;
+	while (len && (*line == ' ' || *line == '\t')) {
+		line++;
+		len--;
+	}
+	if (!len)
+		return -ENOENT;
+
+	if (format == DEDUP_BARCODES) {
+		if (tdx_barcode_decode(line, len, &hw, &val))
+			return -EINVAL;
+		*key = dedup_serial_key(ctx->type, val);
+		return 0;
+	}
+
+	if (*line == '{') {
+		serial = dedup_json_field(line, len, "serial", &serial_len);
+		if (ctx->type == TDX_EEPROM_ID_MODULE)
+			mac = dedup_json_field(line, len, "mac", &mac_len);
+	} else {
+		const char *comma;
+
+		if (len > 12 && !memcmp(line, "file,offset,", 12))
+			return -ENOENT;
+
+		/* serial and mac are the last two CSV fields */
+		comma = memrchr(line, ',', len);
+		if (!comma)
+			return -EINVAL;
+		mac = comma + 1;
+		mac_len = line + len - mac;
+		serial = memrchr(line, ',', comma - line);
+		if (!serial)
+			return -EINVAL;
+		serial++;
+		serial_len = comma - serial;
+		if (serial_len >= 2 && *serial == '"') {
+			serial++;
+			serial_len -= 2;
+		}
+	}
+
+	if (mac && mac_len)
+		return dedup_parse_mac(mac, mac_len, key);
+
+	if (!serial || dedup_parse_serial(serial, serial_len, &val))
+		return -EINVAL;
+	*key = dedup_serial_key(ctx->type, val);
+	return 0;
+}
+
+static int dedup_detect(const char *path)
+{
+	struct toradex_tag tag;
+	char head[16] = "";
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return DEDUP_BARCODES;
+	len = read(fd, head, sizeof(head));
+	close(fd);
+
+	if (len >= (ssize_t)sizeof(tag)) {
+		memcpy(&tag, head, sizeof(tag));
+		if (tag.id == TDX_TAG_VALID && tag.flags == TDX_TAG_FLAG_VALID)
+			return DEDUP_BLOCKS;
+	}
+	if (len > 0 && (head[0] == '{' || !strncmp(head, "file,offset,", 12)))
+		return DEDUP_SCAN;
+
+	return DEDUP_BARCODES;
+}
+
+static void dedup_unit(struct dedup_worker *w, u32 u)
+{
+	struct dedup_ctx *ctx = w->ctx;
+	struct dedup_unit *unit = &ctx->units[u];
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t start, end, map_start;
+	const char *map, *p, *stop, *eof;
+	struct stat st;
+	u32 count = 0;
+	int fd;
+
+	fd = open(unit->path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", unit->path,
+			strerror(errno));
+		w->failed++;
+		goto out;
+	}
+
+	start = unit->start;
+	end = unit->end && unit->end < st.st_size ? unit->end : st.st_size;
+	if (start >= end)
+		goto out;
+
+	/* Text lines starting in the unit may run past its end */
+	map_start = (start ? start - 1 : 0) & ~(page - 1);
+	map = mmap(NULL, st.st_size - map_start, PROT_READ, MAP_PRIVATE, fd,
+		   map_start);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map '%s': %s\n", unit->path,
+			strerror(errno));
+		w->failed++;
+		goto out;
+	}
+	madvise((void *)map, st.st_size - map_start, MADV_SEQUENTIAL);
+	p = map + (start - map_start);
+	stop = map + (end - map_start);
+	eof = map + (st.st_size - map_start);
+
+	if (unit->format == DEDUP_BLOCKS) {
+		/* A short tail can't hold a serial, it counts as invalid */
+		while (p < stop) {
+			struct tdx_data data[TDX_CFG_SCAN_BATCH];
+			int ret[TDX_CFG_SCAN_BATCH];
+			size_t n = (stop - p) / ctx->stride;
+
+			if (n > TDX_CFG_SCAN_BATCH)
+				n = TDX_CFG_SCAN_BATCH;
+			if (!n) {
+				w->invalid++;
+				count++;
+				break;
+			}
+
+			tdx_decode_cfg_blocks(ctx->impl, (const u8 *)p,
+					      ctx->stride, n, ctx->type, data,
+					      ret);
+			for (size_t i = 0; i < n; i++, count++) {
+				if (ret[i])
+					w->invalid++;
+				else if (ctx->type == TDX_EEPROM_ID_MODULE)
+					dedup_add(w, dedup_mac_key(
+						  &data[i].eth_addr), u, count);
+				else
+					dedup_add(w, dedup_serial_key(
+						  ctx->type,
+						  data[i].car_serial), u,
+						  count);
+			}
+			p += n * ctx->stride;
+		}
+	} else {
+		/* Lines belong to the unit they start in */
+		if (start && p[-1] != '\n') {
+			p = memchr(p, '\n', eof - p);
+			p = p ? p + 1 : eof;
+		}
+
+		while (p < stop) {
+			const char *nl = memchr(p, '\n', eof - p);
+			uint64_t key;
+			int ret;
+
+			ret = dedup_line(ctx, unit->format, p,
+					 (nl ? nl : eof) - p, &key);
+			if (!ret)
+				dedup_add(w, key, u, count);
+			else if (ret == -EINVAL)
+				w->invalid++;
+			count++;
+			p = nl ? nl + 1 : eof;
+		}
+	}
+
+	munmap((void *)map, st.st_size - map_start);
+out:
+	unit->count = count;
+	if (fd != -1)
+		close(fd);
+}
+
+static int dedup_rec_cmp(const void *a, const void *b)
+{
+	const struct dedup_rec *ra = a, *rb = b;
+
+	if (ra->unit != rb->unit)
+		return ra->unit < rb->unit ? -1 : 1;
+	return ra->index < rb->index ? -1 : ra->index > rb->index;
+}
+
+static void dedup_report(struct dedup_worker *w, struct dedup_rec *group,
+	size_t n)
+{
+	struct dedup_ctx *ctx = w->ctx;
+	uint64_t key = group[0].key;
+	u32 type = key >> 48;
+
+	qsort(group, n, sizeof(*group), dedup_rec_cmp);
+
+	if (type == TDX_EEPROM_ID_MODULE) {
+		struct toradex_eth_addr eth_addr;
+		u8 *a = (u8 *)&eth_addr;
+
+		for (int i = 0; i < 6; i++)
+			a[i] = key >> (40 - 8 * i);
+		dedup_printf(w, "mac=%02x:%02x:%02x:%02x:%02x:%02x "
+			     "serial=%08u", a[0], a[1], a[2], a[3], a[4], a[5],
+			     tdx_get_serial_from_mac(&eth_addr));
+	} else {
+		dedup_printf(w, "serial=%08u", (u32)key);
+	}
+	dedup_printf(w, " count=%zu sources=", n);
+
+	for (size_t i = 0; i < n; i++) {
+		const struct dedup_unit *unit = &ctx->units[group[i].unit];
+
+		if (unit->format == DEDUP_BLOCKS)
+			dedup_printf(w, "%s%s@%lld", i ? "," : "", unit->path,
+				     (long long)(unit->start + (off_t)
+					group[i].index * ctx->stride));
+		else
+			dedup_printf(w, "%s%s:%llu", i ? "," : "", unit->path,
+				     (unsigned long long)(unit->base +
+					group[i].index + 1));
+	}
+	dedup_printf(w, "\n");
+
+	__atomic_fetch_add(&ctx->groups, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ctx->dups, n - 1, __ATOMIC_RELAXED);
+}
+
+/* Load a partition back and report every key found more than once */
+static void dedup_check(struct dedup_worker *w, struct dedup_part *part)
+{
+	size_t n = part->n + part->spilled, size = 16, nheads = 0, ngroup = 0;
+	struct dedup_rec *recs = part->recs, *group = NULL;
+	u32 *slot = NULL, *next = NULL, *heads = NULL;
+
+	part->recs = NULL;
+	if (!n)
+		goto out;
+	if (n >= TDX_CFG_DEDUP_NONE) {
+		fprintf(stderr, "error: too many records in one partition\n");
+		w->failed++;
+		goto out;
+	}
+
+	if (part->spilled) {
+		struct dedup_rec *all = realloc(recs, n * sizeof(*recs));
+		size_t len = part->spilled * sizeof(*recs);
+
+		if (!all)
+			goto nomem;
+		recs = all;
+		if (pread(part->fd, recs + part->n, len, 0) != (ssize_t)len) {
+			fprintf(stderr, "error: cannot read spilled records\n");
+			w->failed++;
+			goto out;
+		}
+	}
+
+	while (size < 2 * n)
+		size *= 2;
+	slot = calloc(size, sizeof(*slot));
+	next = malloc(n * sizeof(*next));
+	heads = malloc((n / 2 + 1) * sizeof(*heads));
+	if (!slot || !next || !heads)
+		goto nomem;
+
+	/* Slots hold the first record of a key + 1, later ones chain on it */
+	for (u32 i = 0; i < n; i++) {
+		size_t h = dedup_hash(recs[i].key) & (size - 1);
+
+		while (slot[h] && recs[slot[h] - 1].key != recs[i].key)
+			h = (h + 1) & (size - 1);
+
+		if (!slot[h]) {
+			slot[h] = i + 1;
+			next[i] = TDX_CFG_DEDUP_NONE;
+		} else {
+			u32 first = slot[h] - 1;
+
+			if (next[first] == TDX_CFG_DEDUP_NONE)
+				heads[nheads++] = first;
+			next[i] = next[first];
+			next[first] = i;
+		}
+	}
+
+	for (size_t i = 0; i < nheads; i++) {
+		size_t count = 0;
+
+		for (u32 r = heads[i]; r != TDX_CFG_DEDUP_NONE; r = next[r]) {
+			if (count == ngroup) {
+				size_t grow = ngroup ? 2 * ngroup : 16;
+				struct dedup_rec *g;
+
+				g = realloc(group, grow * sizeof(*g));
+				if (!g)
+					goto nomem;
+				group = g;
+				ngroup = grow;
+			}
+			group[count++] = recs[r];
+		}
+		dedup_report(w, group, count);
+	}
+	goto out;
+
+nomem:
+	fprintf(stderr, "error: out of memory checking a partition\n");
+	w->failed++;
+out:
+	free(group);
+	free(heads);
+	free(next);
+	free(slot);
+	free(recs);
+	if (part->fd >= 0)
+		close(part->fd);
+	part->fd = -1;
+}
+
+static void *dedup_worker(void *arg)
+{
+	struct dedup_ctx *ctx = arg;
+	struct dedup_worker *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		__atomic_fetch_add(&ctx->failed, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	w->ctx = ctx;
+
+	for (;;) {
+		size_t i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+
+		if (i >= ctx->nunits)
+			break;
+		dedup_unit(w, i);
+	}
+
+	for (unsigned int p = 0; p < TDX_CFG_DEDUP_PARTS; p++) {
+		if (w->n[p])
+			dedup_flush(w, p);
+	}
+
+	__atomic_fetch_add(&ctx->records, w->records, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ctx->invalid, w->invalid, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ctx->failed, w->failed, __ATOMIC_RELAXED);
+	free(w);
+
+	return NULL;
+}
+
+static void *dedup_check_worker(void *arg)
+{
+	struct dedup_ctx *ctx = arg;
+	struct dedup_worker *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		__atomic_fetch_add(&ctx->failed, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	w->ctx = ctx;
+
+	for (;;) {
+		size_t p = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED);
+
+		if (p >= TDX_CFG_DEDUP_PARTS)
+			break;
+		dedup_check(w, &ctx->parts[p]);
+	}
+
+	dedup_out_flush(w);
+	__atomic_fetch_add(&ctx->failed, w->failed, __ATOMIC_RELAXED);
+	free(w);
+
+	return NULL;
+}
+
+/* Run fn on `threads` threads, or inline where one can't be started */
+static void dedup_run(struct dedup_ctx *ctx, int threads,
+	void *(*fn)(void *))
+{
+	ctx->next = 0;
+	run_workers(threads, fn, ctx);
+}
+
+static int dedup_add_unit(struct dedup_ctx *ctx, const char *path,
+	int format, off_t start, off_t end)
+{
+	struct dedup_unit *unit;
+
+	if (ctx->nunits >= TDX_CFG_DEDUP_NONE)
+		return -E2BIG;
+
+	if (ctx->nunits == ctx->units_size) {
+		size_t size = ctx->units_size ? 2 * ctx->units_size : 1024;
+		struct dedup_unit *units;
+
+		units = realloc(ctx->units, size * sizeof(*units));
+		if (!units)
+			return -ENOMEM;
+		ctx->units = units;
+		ctx->units_size = size;
+	}
+
+	unit = &ctx->units[ctx->nunits++];
+	memset(unit, 0, sizeof(*unit));
+	unit->path = path;
+	unit->format = format;
+	unit->start = start;
+	unit->end = end;
+
+	return 0;
+}
+
+/* Queue a file, split so all workers share large ones */
+static int dedup_add_file(struct dedup_ctx *ctx, char *path, off_t size)
+{
+	int format = ctx->format ? ctx->format : dedup_detect(path);
+	off_t chunk = format == DEDUP_BLOCKS ?
+		      TDX_CFG_SCAN_CHUNK * ctx->stride : TDX_CFG_DEDUP_CHUNK;
+	int ret = 0;
+
+	ctx->files++;
+	if (!size)
+		return dedup_add_unit(ctx, path, format, 0, 0);
+
+	for (off_t start = 0; !ret && start < size; start += chunk)
+		ret = dedup_add_unit(ctx, path, format, start, start + chunk);
+
+	return ret;
+}
+
+static int dedup_add_input(struct dedup_ctx *ctx, const char *input)
+{
+	struct dirent *de;
+	struct stat st;
+	char *path;
+	int ret = 0;
+	DIR *d;
+
+	if (stat(input, &st)) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", input,
+			strerror(errno));
+		return -errno;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		path = strdup(input);
+		if (!path)
+			return -ENOMEM;
+		return dedup_add_file(ctx, path, S_ISREG(st.st_mode) ?
+				      st.st_size : 0);
+	}
+
+	d = opendir(input);
+	if (!d) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", input,
+			strerror(errno));
+		return -errno;
+	}
+
+	while (!ret && (de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (asprintf(&path, "%s/%s", input, de->d_name) < 0) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (stat(path, &st)) {
+			free(path);
+		} else if (S_ISDIR(st.st_mode)) {
+			ret = dedup_add_input(ctx, path);
+			free(path);
+		} else if (S_ISREG(st.st_mode)) {
+			ret = dedup_add_file(ctx, path, st.st_size);
+		} else {
+			free(path);
+		}
+	}
+
+	closedir(d);
+	return ret;
+}
+
+static int do_cfgblock_dedup(int argc, char *argv[])
+{
+	struct dedup_ctx ctx;
+	struct timespec start;
+	long threads = parse_threads(NULL);
+	unsigned long mem = TDX_CFG_DEDUP_MEM;
+	int ninputs = 0, ret = CMD_RET_SUCCESS;
+	double secs;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.type = TDX_EEPROM_ID_MODULE;
+	ctx.impl = tdx_tlv_best_impl();
+	ctx.tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			threads = parse_threads(argv[++i]);
+		} else if (!strcmp(argv[i], "--stride") && i + 1 < argc) {
+			ctx.stride = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--mem") && i + 1 < argc) {
+			mem = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--tmpdir") && i + 1 < argc) {
+			ctx.tmpdir = argv[++i];
+		} else if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+			int type = tdx_type_from_name(argv[++i]);
+
+			if (type < 0) {
+				printf("error: unknown block type '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+			ctx.type = type;
+		} else if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+			i++;
+			for (ctx.format = DEDUP_FORMAT_COUNT - 1;
+			     ctx.format > 0; ctx.format--) {
+				if (!strcmp(argv[i],
+					    dedup_format_name[ctx.format]))
+					break;
+			}
+			if (!ctx.format && strcmp(argv[i], "auto")) {
+				printf("error: unknown format '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+		} else {
+			argv[ninputs++] = argv[i];
+		}
+	}
+
+	if (!ctx.stride)
+		ctx.stride = ctx.type == TDX_EEPROM_ID_MODULE ?
+			     TDX_CFG_BLOCK_MAX_SIZE :
+			     TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
+	ctx.mem_max = (size_t)mem * 1024 * 1024 / sizeof(struct dedup_rec);
+
+	if (!ninputs || threads < 1 || ctx.stride < 8) {
+		printf("error: usage: dedup [-j n] [--type t] [--stride n] "
+		       "[--format auto|blocks|barcodes|scan] [--mem MiB] "
+		       "[--tmpdir dir] <dir|file>...\n");
+		return CMD_RET_USAGE;
+	}
+
+	for (int p = 0; p < TDX_CFG_DEDUP_PARTS; p++) {
+		pthread_mutex_init(&ctx.parts[p].lock, NULL);
+		ctx.parts[p].fd = -1;
+	}
+	pthread_mutex_init(&ctx.out_lock, NULL);
+
+	for (int i = 0; i < ninputs; i++) {
+		if (dedup_add_input(&ctx, argv[i]))
+			ret = CMD_RET_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dedup_run(&ctx, threads, dedup_worker);
+
+	/* Line numbers continue from the previous unit of the same file */
+	for (size_t i = 1; i < ctx.nunits; i++) {
+		if (ctx.units[i].start)
+			ctx.units[i].base = ctx.units[i - 1].base +
+					    ctx.units[i - 1].count;
+	}
+
+	dedup_run(&ctx, threads, dedup_check_worker);
+	fflush(stdout);
+
+	secs = elapsed_ms(&start) / 1e3;
+	fprintf(stderr, "files=%lu records=%lu invalid=%lu spilled=%lu "
+		"duplicates=%lu keys=%lu errors=%lu elapsed=%.3fs "
+		"rate=%.0f/s\n", ctx.files, ctx.records, ctx.invalid,
+		ctx.spilled, ctx.dups, ctx.groups, ctx.failed, secs,
+		secs > 0 ? ctx.records / secs : 0);
+
+	for (size_t i = 0; i < ctx.nunits; i++) {
+		if (!ctx.units[i].start)
+			free((char *)ctx.units[i].path);
+	}
+	free(ctx.units);
+	for (int p = 0; p < TDX_CFG_DEDUP_PARTS; p++)
+		pthread_mutex_destroy(&ctx.parts[p].lock);
+	pthread_mutex_destroy(&ctx.out_lock);
+
+	if (ctx.failed)
+		return CMD_RET_FAILURE;
+	return ctx.groups ? CMD_RET_FAILURE : ret;
+}
+
+/*
+ * The index maps MACs and serials seen in the fleet back to the product. It
+ * is a header followed by fixed size records sorted by serial, so lookups
+ * binary search the mmapped file directly. MACs are turned into the serial
+ * tdx_get_serial_from_mac() gives and then checked against the record.
+ */
+#define TDX_CFG_INDEX_FILE	"tdx-cfgblock.idx"
+#define TDX_CFG_INDEX_MAGIC	0x58444954 /* "TIDX" */
+#define TDX_CFG_INDEX_VERSION	1
+
+struct tdx_index_header {
+	u32 magic;
+	u32 version;
+	u32 rec_size;
+	u32 reserved;
+	uint64_t count;
+};
+
+struct tdx_index_rec {
+	u32 serial;
+	struct toradex_hw hw;
+	struct toradex_eth_addr eth_addr;	/* zero for carriers */
+	u16 type;
+} __attribute__((__packed__));
+
+struct index_ctx {
+	u32 type;
+	size_t stride;
+	int impl;
+	struct tdx_index_rec *recs;
+	size_t count;
+	size_t size;
+	unsigned long files;
+	unsigned long invalid;
+};
+
+static int index_add_rec(struct index_ctx *ctx, u32 type, u32 serial,
+	const struct toradex_hw *hw, const struct toradex_eth_addr *eth_addr)
+{
+	struct tdx_index_rec *rec;
+
+	if (ctx->count == ctx->size) {
+		size_t size = ctx->size ? 2 * ctx->size : 65536;
+
+		rec = realloc(ctx->recs, size * sizeof(*rec));
+		if (!rec)
+			return -ENOMEM;
+		ctx->recs = rec;
+		ctx->size = size;
+	}
+
+	rec = &ctx->recs[ctx->count++];
+	memset(rec, 0, sizeof(*rec));
+	rec->serial = serial;
+	rec->hw = *hw;
+	if (eth_addr)
+		rec->eth_addr = *eth_addr;
+	rec->type = type;
+
+	return 0;
+}
+
+/* Field n counted from the end of a CSV line, unquoted */
+static const char *index_csv_field(const char *line, size_t len, int n,
+	size_t *field_len)
+{
+	const char *end = line + len, *comma = end;
+
+	for (int i = 0; i <= n; i++) {
+		end = comma;
+		comma = memrchr(line, ',', end - line);
+		if (!comma)
+			return NULL;
+	}
+
+	*field_len = end - comma - 1;
+	if (*field_len >= 2 && comma[1] == '"') {
+		*field_len -= 2;
+		return comma + 2;
+	}
+	return comma + 1;
+}
+
+/* One line of scan output, JSON Lines or CSV, or a 16 digit barcode */
+static int index_line(struct index_ctx *ctx, const char *line, size_t len)
+{
+	const char *prodid, *rev, *serial, *mac = NULL;
+	size_t prodid_len, rev_len, serial_len, mac_len = 0;
+	struct toradex_eth_addr eth_addr;
+	struct toradex_hw hw;
+	char rev_str[16];
+	u32 val, pid4;
+
+	if (!len || (len > 12 && !memcmp(line, "file,offset,", 12)))
+		return -ENOENT;
+
+	if (isdigit((unsigned char)*line)) {
+		if (len > 1 && line[len - 1] == '\r')
+			len--;
+		if (tdx_barcode_decode(line, len, &hw, &val))
+			return -EINVAL;
+		goto add;
+	}
+
+	if (*line == '{') {
+		prodid = dedup_json_field(line, len, "prodid", &prodid_len);
+		rev = dedup_json_field(line, len, "rev", &rev_len);
+		serial = dedup_json_field(line, len, "serial", &serial_len);
+		mac = dedup_json_field(line, len, "mac", &mac_len);
+	} else {
+		mac = index_csv_field(line, len, 0, &mac_len);
+		serial = index_csv_field(line, len, 1, &serial_len);
+		rev = index_csv_field(line, len, 2, &rev_len);
+		prodid = index_csv_field(line, len, 4, &prodid_len);
+	}
+
+	/* rev is "V1.1B" or "V1.1#26" */
+	if (!prodid || !rev || !serial || rev_len < 5 ||
+	    rev_len >= sizeof(rev_str) || *rev != 'V' ||
+	    dedup_parse_serial(prodid, prodid_len, &pid4) ||
+	    dedup_parse_serial(serial, serial_len, &val))
+		return -EINVAL;
+
+	memcpy(rev_str, rev + 1, rev_len - 1);
+	rev_str[rev_len - 1] = '\0';
+	memset(&hw, 0, sizeof(hw));
+	hw.prodid = pid4;
+	hw.ver_major = rev_str[0] - '0';
+	hw.ver_minor = rev_str[2] - '0';
+	if (hw.ver_major > 9 || hw.ver_minor > 9 || rev_str[1] != '.' ||
+	    parse_assembly_string(rev_str, &hw.ver_assembly))
+		return -EINVAL;
+
+add:
+	if (ctx->type != TDX_EEPROM_ID_MODULE)
+		return index_add_rec(ctx, ctx->type, val, &hw, NULL);
+
+	if (mac_len) {
+		if (parse_eth_addr(mac, mac_len, &eth_addr))
+			return -EINVAL;
+	} else {
+		tdx_get_mac_from_serial(val, &eth_addr);
+	}
+	return index_add_rec(ctx, ctx->type, val, &hw, &eth_addr);
+}
+
+static int index_file(struct index_ctx *ctx, const char *path)
+{
+	const char *map, *p, *end;
+	struct stat st;
+	int fd, ret = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", path,
+			strerror(errno));
+		ret = -errno;
+		goto out;
+	}
+
+	ctx->files++;
+	if (!st.st_size)
+		goto out;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map '%s': %s\n", path,
+			strerror(errno));
+		ret = -errno;
+		goto out;
+	}
+	madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+	end = map + st.st_size;
+
+	if (dedup_detect(path) == DEDUP_BLOCKS) {
+		for (p = map; !ret && p + ctx->stride <= end;) {
+			struct tdx_data data[TDX_CFG_SCAN_BATCH];
+			int rets[TDX_CFG_SCAN_BATCH];
+			size_t n = (end - p) / ctx->stride;
+
+			if (n > TDX_CFG_SCAN_BATCH)
+				n = TDX_CFG_SCAN_BATCH;
+
+			tdx_decode_cfg_blocks(ctx->impl, (const u8 *)p,
+					      ctx->stride, n, ctx->type, data,
+					      rets);
+			for (size_t i = 0; !ret && i < n; i++) {
+				const struct tdx_data *d = &data[i];
+
+				if (rets[i])
+					ctx->invalid++;
+				else if (ctx->type == TDX_EEPROM_ID_MODULE)
+					ret = index_add_rec(ctx, ctx->type,
+						tdx_get_serial_from_mac(&d->eth_addr),
+						&d->hw_tag, &d->eth_addr);
+				else
+					ret = index_add_rec(ctx, ctx->type,
+						d->car_serial, &d->car_hw_tag,
+						NULL);
+			}
+			p += n * ctx->stride;
+		}
+	} else {
+		for (p = map; !ret && p < end;) {
+			const char *nl = memchr(p, '\n', end - p);
+
+			ret = index_line(ctx, p, (nl ? nl : end) - p);
+			if (ret == -EINVAL)
+				ctx->invalid++;
+			if (ret != -ENOMEM)
+				ret = 0;
+			p = nl ? nl + 1 : end;
+		}
+	}
+
+	munmap((void *)map, st.st_size);
+out:
+	if (fd != -1)
+		close(fd);
+	return ret;
+}
+
+static int index_add_input(struct index_ctx *ctx, const char *input)
+{
+	struct dirent *de;
+	struct stat st;
+	char *path;
+	int ret = 0;
+	DIR *d;
+
+	if (stat(input, &st)) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", input,
+			strerror(errno));
+		return -errno;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+		return index_file(ctx, input);
+
+	d = opendir(input);
+	if (!d) {
+		fprintf(stderr, "error: cannot open '%s': %s\n", input,
+			strerror(errno));
+		return -errno;
+	}
+
+	while (!ret && (de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (asprintf(&path, "%s/%s", input, de->d_name) < 0) {
+			ret = -ENOMEM;
+			break;
+		}
+		if (!stat(path, &st) &&
+		    (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)))
+			ret = index_add_input(ctx, path);
+		free(path);
+	}
+
+	closedir(d);
+	return ret;
+}
+
+static int index_rec_cmp(const void *a, const void *b)
+{
+	const struct tdx_index_rec *ra = a, *rb = b;
+
+	if (ra->serial != rb->serial)
+		return ra->serial < rb->serial ? -1 : 1;
+	if (ra->type != rb->type)
+		return ra->type < rb->type ? -1 : 1;
+	return memcmp(ra, rb, sizeof(*ra));
+}
+
+static int do_cfgblock_index_build(int argc, char *argv[])
+{
+	struct tdx_index_header hdr;
+	struct index_ctx ctx;
+	struct timespec start;
+	const char *file = TDX_CFG_INDEX_FILE;
+	char tmp[PATH_MAX];
+	int ninputs = 0, ret = CMD_RET_SUCCESS, sorted = 1, failed;
+	size_t len;
+	FILE *f;
+	int fd;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.type = TDX_EEPROM_ID_MODULE;
+	ctx.impl = tdx_tlv_best_impl();
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			file = argv[++i];
+		} else if (!strcmp(argv[i], "--stride") && i + 1 < argc) {
+			ctx.stride = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+			int type = tdx_type_from_name(argv[++i]);
+
+			if (type < 0) {
+				printf("error: unknown block type '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+			ctx.type = type;
+		} else {
+			argv[ninputs++] = argv[i];
+		}
+	}
+
+	if (!ctx.stride)
+		ctx.stride = ctx.type == TDX_EEPROM_ID_MODULE ?
+			     TDX_CFG_BLOCK_MAX_SIZE :
+			     TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
+
+	if (!ninputs || ctx.stride < 8) {
+		printf("error: usage: index build [-o file] [--type t] "
+		       "[--stride n] <dir|file>...\n");
+		return CMD_RET_USAGE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ninputs; i++) {
+		if (index_add_input(&ctx, argv[i]))
+			ret = CMD_RET_FAILURE;
+	}
+	if (ret)
+		goto out;
+
+	/* generate output comes in serial order already */
+	for (size_t i = 1; sorted && i < ctx.count; i++)
+		sorted = index_rec_cmp(&ctx.recs[i - 1], &ctx.recs[i]) <= 0;
+	if (!sorted)
+		qsort(ctx.recs, ctx.count, sizeof(*ctx.recs), index_rec_cmp);
+
+	/* The same block seen in several inputs is indexed once */
+	if (ctx.count) {
+		size_t n = 1;
+
+		for (size_t i = 1; i < ctx.count; i++) {
+			if (memcmp(&ctx.recs[i], &ctx.recs[n - 1],
+				   sizeof(*ctx.recs)))
+				ctx.recs[n++] = ctx.recs[i];
+		}
+		ctx.count = n;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TDX_CFG_INDEX_MAGIC;
+	hdr.version = TDX_CFG_INDEX_VERSION;
+	hdr.rec_size = sizeof(struct tdx_index_rec);
+	hdr.count = ctx.count;
+
+	/* Replace the index atomically, lookups may have it mapped */
+	snprintf(tmp, sizeof(tmp), "%s.tmp-XXXXXX", file);
+	fd = mkstemp(tmp);
+	f = fd == -1 ? NULL : fdopen(fd, "w");
+	if (!f) {
+		printf("error: cannot create '%s': %s.\n", tmp, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		ret = CMD_RET_FAILURE;
+		goto out;
+	}
+
+	len = ctx.count * sizeof(*ctx.recs);
+	failed = fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+		 (len && fwrite(ctx.recs, len, 1, f) != 1) ||
+		 fchmod(fd, 0644);
+	if (fclose(f) || failed || rename(tmp, file)) {
+		printf("error: cannot write '%s': %s.\n", file,
+		       strerror(errno));
+		unlink(tmp);
+		ret = CMD_RET_FAILURE;
+		goto out;
+	}
+
+	fprintf(stderr, "files=%lu records=%zu invalid=%lu elapsed=%.3fs\n",
+		ctx.files, ctx.count, ctx.invalid, elapsed_ms(&start) / 1e3);
+out:
+	free(ctx.recs);
+	return ret;
+}
+
+static void index_print_rec(const struct tdx_index_rec *rec)
+{
+	struct tdx_data data;
+
+	memset(&data, 0, sizeof(data));
+	if (rec->type == TDX_EEPROM_ID_MODULE) {
+		const u8 *a = (const u8 *)&rec->eth_addr;
+
+		data.hw_tag = rec->hw;
+		data.serial = rec->serial;
+		print_tdx_data(rec->type, &data);
+		printf("module_mac=\"%02x:%02x:%02x:%02x:%02x:%02x\"\n",
+		       a[0], a[1], a[2], a[3], a[4], a[5]);
+	} else {
+		data.car_hw_tag = rec->hw;
+		data.car_serial = rec->serial;
+		print_tdx_data(rec->type, &data);
+	}
+}
+
+static int do_cfgblock_index_lookup(int argc, char *argv[])
+{
+	const struct tdx_index_header *hdr;
+	const struct tdx_index_rec *recs;
+	const char *file = TDX_CFG_INDEX_FILE;
+	int nkeys = 0, ret = CMD_RET_SUCCESS;
+	struct stat st;
+	void *map;
+	int fd;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc)
+			file = argv[++i];
+		else
+			argv[nkeys++] = argv[i];
+	}
+
+	if (!nkeys) {
+		printf("error: usage: index lookup [-f file] <mac|serial>...\n");
+		return CMD_RET_USAGE;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		printf("error: cannot open '%s': %s.\n", file, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return CMD_RET_FAILURE;
+	}
+
+	map = st.st_size >= sizeof(*hdr) ?
+	      mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	hdr = map;
+	if (map == MAP_FAILED || hdr->magic != TDX_CFG_INDEX_MAGIC ||
+	    hdr->version != TDX_CFG_INDEX_VERSION ||
+	    hdr->rec_size != sizeof(*recs) ||
+	    hdr->count > (st.st_size - sizeof(*hdr)) / sizeof(*recs)) {
+		printf("error: '%s' is not a valid index.\n", file);
+		if (map != MAP_FAILED)
+			munmap(map, st.st_size);
+		return CMD_RET_FAILURE;
+	}
+	recs = (const struct tdx_index_rec *)(hdr + 1);
+
+	for (int k = 0; k < nkeys; k++) {
+		struct toradex_eth_addr eth_addr;
+		size_t len = strlen(argv[k]), lo = 0, hi = hdr->count, mid;
+		int is_mac = !!strchr(argv[k], ':'), found = 0;
+		u32 serial;
+
+		if (is_mac ? parse_eth_addr(argv[k], len, &eth_addr) :
+			     dedup_parse_serial(argv[k], len, &serial)) {
+			printf("error: '%s' is neither a MAC nor a serial.\n",
+			       argv[k]);
+			ret = CMD_RET_FAILURE;
+			continue;
+		}
+		if (is_mac)
+			serial = tdx_get_serial_from_mac(&eth_addr);
+
+		/* First record with this serial */
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (recs[mid].serial < serial)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (; lo < hdr->count && recs[lo].serial == serial; lo++) {
+			if (is_mac && (recs[lo].type != TDX_EEPROM_ID_MODULE ||
+				       memcmp(&recs[lo].eth_addr, &eth_addr,
+					      sizeof(eth_addr))))
+				continue;
+			if (found++ || k)
+				printf("\n");
+			index_print_rec(&recs[lo]);
+		}
+
+		if (!found) {
+			printf("error: '%s' not found.\n", argv[k]);
+			ret = CMD_RET_FAILURE;
+		}
+	}
+
+	munmap(map, st.st_size);
+	return ret;
+}
+
+static int do_cfgblock_index(int argc, char *argv[])
+{
+	if (argc >= 1 && !strcmp(argv[0], "build"))
+		return do_cfgblock_index_build(argc - 1, argv + 1);
+	if (argc >= 1 && !strcmp(argv[0], "lookup"))
+		return do_cfgblock_index_lookup(argc - 1, argv + 1);
+
+	printf("error: usage: index build|lookup ...\n");
+	return CMD_RET_USAGE;
+}
+
+/*
+ * export --columnar writes decoded blocks as one fixed width column per
+ * field behind a small header, run-length encoding the columns where that
+ * is smaller. aggregate reads only the columns it groups by and walks runs
+ * rather than rows, so counting a fleet per product and revision is cheap.
+ */
+#define TDX_CFG_COL_MAGIC	0x4c4f4354 /* "TCOL" */
+#define TDX_CFG_COL_VERSION	1
+#define TDX_CFG_COL_PLAIN	0
+#define TDX_CFG_COL_RLE		1	/* u32 run length, then the value */
+#define TDX_CFG_COL_NO_OUI	0xff
+
+enum {
+	COL_TYPE,
+	COL_PRODID,
+	COL_VER_MAJOR,
+	COL_VER_MINOR,
+	COL_VER_ASSEMBLY,
+	COL_SERIAL,
+	COL_OUI,
+	COL_COUNT,
+};
+
+static const struct {
+	const char *name;
+	u8 width;
+} export_cols[COL_COUNT] = {
+	[COL_TYPE]		= { "type", 1 },
+	[COL_PRODID]		= { "prodid", 2 },
+	[COL_VER_MAJOR]		= { "ver_major", 1 },
+	[COL_VER_MINOR]		= { "ver_minor", 1 },
+	[COL_VER_ASSEMBLY]	= { "ver_assembly", 2 },
+	[COL_SERIAL]		= { "serial", 4 },
+	[COL_OUI]		= { "oui", 1 },
+};
+
+struct tdx_col_header {
+	u32 magic;
+	u16 version;
+	u16 ncols;
+	uint64_t rows;
+};
+
+struct tdx_col_desc {
+	char name[16];
+	u8 width;
+	u8 encoding;
+	u16 reserved;
+	u32 runs;		/* RLE only */
+	uint64_t offset;
+	uint64_t size;
+};
+
+static u32 export_value(const struct tdx_index_rec *rec, int col)
+{
+	switch (col) {
+	case COL_TYPE:
+		return rec->type;
+	case COL_PRODID:
+		return rec->hw.prodid;
+	case COL_VER_MAJOR:
+		return rec->hw.ver_major;
+	case COL_VER_MINOR:
+		return rec->hw.ver_minor;
+	case COL_VER_ASSEMBLY:
+		return rec->hw.ver_assembly;
+	case COL_SERIAL:
+		return rec->serial;
+	case COL_OUI:
+		return rec->type == TDX_EEPROM_ID_MODULE ?
+		       rec->serial >> 24 : TDX_CFG_COL_NO_OUI;
+	}
+	return 0;
+}
+
+/* Little endian, as the rest of the block data */
+static void export_put(FILE *f, u32 value, int width)
+{
+	u8 buf[4];
+
+	for (int i = 0; i < width; i++)
+		buf[i] = value >> (8 * i);
+	fwrite(buf, width, 1, f);
+}
+
+static int do_cfgblock_export(int argc, char *argv[])
+{
+	struct tdx_col_desc desc[COL_COUNT];
+	struct tdx_col_header hdr;
+	struct index_ctx ctx;
+	struct timespec start;
+	const char *file = NULL;
+	int ninputs = 0, columnar = 0, ret = CMD_RET_SUCCESS, failed;
+	uint64_t offset;
+	FILE *f;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.type = TDX_EEPROM_ID_MODULE;
+	ctx.impl = tdx_tlv_best_impl();
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--columnar")) {
+			columnar = 1;
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			file = argv[++i];
+		} else if (!strcmp(argv[i], "--stride") && i + 1 < argc) {
+			ctx.stride = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+			int type = tdx_type_from_name(argv[++i]);
+
+			if (type < 0) {
+				printf("error: unknown block type '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+			ctx.type = type;
+		} else {
+			argv[ninputs++] = argv[i];
+		}
+	}
+
+	if (!ctx.stride)
+		ctx.stride = ctx.type == TDX_EEPROM_ID_MODULE ?
+			     TDX_CFG_BLOCK_MAX_SIZE :
+			     TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
+
+	if (!columnar || !file || !ninputs || ctx.stride < 8) {
+		printf("error: usage: export --columnar -o file [--type t] "
+		       "[--stride n] <dir|file>...\n");
+		return CMD_RET_USAGE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ninputs; i++) {
+		if (index_add_input(&ctx, argv[i]))
+			ret = CMD_RET_FAILURE;
+	}
+	if (ret)
+		goto out;
+
+	if (!ctx.count && ctx.invalid) {
+		printf("error: no valid record in the input.\n");
+		ret = CMD_RET_FAILURE;
+		goto out;
+	}
+
+	/* Plain or RLE, whichever is smaller, laid out after the header */
+	memset(desc, 0, sizeof(desc));
+	offset = sizeof(hdr) + sizeof(desc);
+	for (int c = 0; c < COL_COUNT; c++) {
+		u32 runs = 0;
+
+		for (size_t i = 0; i < ctx.count; i++) {
+			if (!i || export_value(&ctx.recs[i], c) !=
+				  export_value(&ctx.recs[i - 1], c))
+				runs++;
+		}
+
+		strncpy(desc[c].name, export_cols[c].name,
+			sizeof(desc[c].name) - 1);
+		desc[c].width = export_cols[c].width;
+		desc[c].offset = offset;
+		desc[c].size = (uint64_t)ctx.count * desc[c].width;
+		if ((uint64_t)runs * (4 + desc[c].width) < desc[c].size) {
+			desc[c].encoding = TDX_CFG_COL_RLE;
+			desc[c].runs = runs;
+			desc[c].size = (uint64_t)runs * (4 + desc[c].width);
+		}
+		offset += desc[c].size;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TDX_CFG_COL_MAGIC;
+	hdr.version = TDX_CFG_COL_VERSION;
+	hdr.ncols = COL_COUNT;
+	hdr.rows = ctx.count;
+
+	f = fopen(file, "w");
+	if (!f) {
+		printf("error: cannot create '%s': %s.\n", file,
+		       strerror(errno));
+		ret = CMD_RET_FAILURE;
+		goto out;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(desc, sizeof(desc), 1, f);
+	for (int c = 0; c < COL_COUNT; c++) {
+		int width = desc[c].width;
+
+		for (size_t i = 0; i < ctx.count;) {
+			u32 value = export_value(&ctx.recs[i], c);
+			size_t run = 1;
+
+			if (desc[c].encoding == TDX_CFG_COL_PLAIN) {
+				export_put(f, value, width);
+				i++;
+				continue;
+			}
+
+			while (i + run < ctx.count && run < UINT32_MAX &&
+			       export_value(&ctx.recs[i + run], c) == value)
+				run++;
+			export_put(f, run, 4);
+			export_put(f, value, width);
+			i += run;
+		}
+	}
+
+	failed = ferror(f);
+	if (fclose(f) || failed) {
+		printf("error: cannot write '%s': %s.\n", file,
+		       strerror(errno));
+		unlink(file);
+		ret = CMD_RET_FAILURE;
+		goto out;
+	}
+
+	fprintf(stderr, "files=%lu rows=%zu invalid=%lu bytes=%llu "
+		"elapsed=%.3fs\n", ctx.files, ctx.count, ctx.invalid,
+		(unsigned long long)offset, elapsed_ms(&start) / 1e3);
+out:
+	free(ctx.recs);
+	return ret;
+}
+
+/* Reads one column run by run, plain columns being runs of 1 */
+struct col_cursor {
+	const u8 *p;
+	const u8 *end;
+	int width;
+	int rle;
+	uint64_t left;		/* rows left in the current run */
+	u32 value;
+};
+
+static u32 col_get(const u8 *p, int width)
+{
+	u32 value = 0;
+
+	for (int i = 0; i < width; i++)
+		value |= (u32)p[i] << (8 * i);
+	return value;
+}
+
+static int col_next(struct col_cursor *c)
+{
+	int len = c->rle ? 4 + c->width : c->width;
+
+	if (c->end - c->p < len)
+		return -EINVAL;
+
+	if (c->rle) {
+		c->left = col_get(c->p, 4);
+		c->value = col_get(c->p + 4, c->width);
+	} else {
+		c->left = 1;
+		c->value = col_get(c->p, c->width);
+	}
+	c->p += len;
+
+	return c->left ? 0 : -EINVAL;
+}
+
+struct agg_entry {
+	uint64_t key;
+	uint64_t count;
+};
+
+struct agg_table {
+	struct agg_entry *slots;
+	size_t size;		/* power of two */
+	size_t used;
+};
+
+static int agg_add(struct agg_table *t, uint64_t key, uint64_t count)
+{
+	size_t h;
+
+	/* Keys are stored + 1 so an empty slot is 0 */
+	if (2 * (t->used + 1) > t->size) {
+		struct agg_table bigger = { .size = t->size ? 2 * t->size : 256 };
+
+		bigger.slots = calloc(bigger.size, sizeof(*bigger.slots));
+		if (!bigger.slots)
+			return -ENOMEM;
+		for (size_t i = 0; i < t->size; i++) {
+			if (t->slots[i].key)
+				agg_add(&bigger, t->slots[i].key - 1,
+					t->slots[i].count);
+		}
+		free(t->slots);
+		*t = bigger;
+	}
+
+	h = dedup_hash(key) & (t->size - 1);
+	while (t->slots[h].key && t->slots[h].key != key + 1)
+		h = (h + 1) & (t->size - 1);
+
+	if (!t->slots[h].key) {
+		t->slots[h].key = key + 1;
+		t->used++;
+	}
+	t->slots[h].count += count;
+
+	return 0;
+}
+
+static int agg_entry_cmp(const void *a, const void *b)
+{
+	const struct agg_entry *ea = a, *eb = b;
+
+	return ea->key < eb->key ? -1 : ea->key > eb->key;
+}
+
+/* Bits a grouped column takes in an aggregation key */
+static int agg_bits(int col)
+{
+	switch (col) {
+	case COL_PRODID:
+		return 16;
+	case COL_VER_MAJOR:	/* major, minor and assembly */
+		return 24;
+	default:
+		return 8;
+	}
+}
+
+static u32 agg_value(const struct col_cursor *cur, int col)
+{
+	if (col == COL_VER_MAJOR)
+		return (cur[COL_VER_MAJOR].value & 0xf) << 20 |
+		       (cur[COL_VER_MINOR].value & 0xf) << 16 |
+		       (cur[COL_VER_ASSEMBLY].value & 0xffff);
+	return cur[col].value;
+}
+
+static void agg_print(const int *by, int nby, int print_type, uint64_t key,
+	uint64_t count)
+{
+	char assembly[TDX_ASSEMBLY_STR_LEN];
+	u32 v[COL_COUNT] = { 0 };
+
+	/* The first grouped column is in the top bits */
+	for (int i = nby - 1; i >= 0; i--) {
+		v[by[i]] = key & ((1ULL << agg_bits(by[i])) - 1);
+		key >>= agg_bits(by[i]);
+	}
+
+	for (int i = print_type ? 0 : 1; i < nby; i++) {
+		u32 val = v[by[i]];
+
+		switch (by[i]) {
+		case COL_TYPE:
+			printf("type=%s ", val < TDX_EEPROM_ID_COUNT ?
+			       nv_dev_type_name[val] : "unknown");
+			break;
+		case COL_PRODID:
+			printf("prodid=%04u prodname=\"%s\" ", val,
+			       v[COL_TYPE] == TDX_EEPROM_ID_CARRIER ?
+			       tdx_get_carrier_boards(val) :
+			       v[COL_TYPE] == TDX_EEPROM_ID_DISPLAY_ADAPTER ?
+			       tdx_get_display_adapters(val) :
+			       val < toradex_modules_count ?
+			       toradex_modules[val].name : "UNKNOWN MODULE");
+			break;
+		case COL_VER_MAJOR:
+			printf("rev=\"V%u.%u%s\" ", val >> 20, (val >> 16) & 0xf,
+			       tdx_get_board_assembly_r(val & 0xffff, assembly,
+							sizeof(assembly)));
+			break;
+		case COL_OUI:
+			if (val == TDX_CFG_COL_NO_OUI)
+				printf("oui=none ");
+			else
+				printf("oui=%u ", val);
+			break;
+		}
+	}
+	printf("count=%llu\n", (unsigned long long)count);
+}
+
+static int do_cfgblock_aggregate(int argc, char *argv[])
+{
+	struct col_cursor cur[COL_COUNT];
+	const struct tdx_col_header *hdr;
+	const struct tdx_col_desc *desc;
+	struct agg_table table = { 0 };
+	char by_default[] = "prodid,rev", *by_arg = by_default, *name;
+	int by[COL_COUNT], cols[COL_COUNT], want[COL_COUNT] = { 0 };
+	int nby = 1, ncols = 0, nfiles = 0, print_type = 0;
+	const char *file = NULL;
+	uint64_t rows = 0;
+	int ret = CMD_RET_SUCCESS;
+	struct stat st;
+	u8 *map = MAP_FAILED;
+	int fd;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--by") && i + 1 < argc)
+			by_arg = argv[++i];
+		else if (!nfiles++)
+			file = argv[i];
+	}
+
+	/*
+	 * Rows are always grouped by type first, product ids only mean
+	 * something within one. rev stands for the three version columns.
+	 */
+	by[0] = COL_TYPE;
+	want[COL_TYPE] = 1;
+	for (name = strtok(by_arg, ","); name; name = strtok(NULL, ",")) {
+		int c = !strcmp(name, "rev") ? COL_VER_MAJOR : -1;
+
+		if (!strcmp(name, "type")) {
+			print_type = 1;
+			continue;
+		}
+		if (!strcmp(name, "prodid"))
+			c = COL_PRODID;
+		else if (!strcmp(name, "oui"))
+			c = COL_OUI;
+		if (c < 0 || want[c]) {
+			nfiles = 0;
+			break;
+		}
+		by[nby++] = c;
+		want[c] = 1;
+		if (c == COL_VER_MAJOR)
+			want[COL_VER_MINOR] = want[COL_VER_ASSEMBLY] = 1;
+	}
+	for (int c = 0; c < COL_COUNT; c++) {
+		if (want[c])
+			cols[ncols++] = c;
+	}
+
+	if (nfiles != 1) {
+		printf("error: usage: aggregate [--by type,prodid,rev,oui] "
+		       "file\n");
+		return CMD_RET_USAGE;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		printf("error: cannot open '%s': %s.\n", file, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return CMD_RET_FAILURE;
+	}
+
+	map = st.st_size >= sizeof(*hdr) + COL_COUNT * sizeof(*desc) ?
+	      mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	hdr = (const struct tdx_col_header *)map;
+	if (map == MAP_FAILED || hdr->magic != TDX_CFG_COL_MAGIC ||
+	    hdr->version != TDX_CFG_COL_VERSION || hdr->ncols != COL_COUNT) {
+		printf("error: '%s' is not a columnar export.\n", file);
+		ret = CMD_RET_FAILURE;
+		goto out;
+	}
+	desc = (const struct tdx_col_desc *)(hdr + 1);
+
+	/* Check every column, a truncated file may still hold the grouped ones */
+	for (int i = 0; i < COL_COUNT; i++) {
+		const struct tdx_col_desc *d = &desc[i];
+		uint64_t size = d->encoding == TDX_CFG_COL_RLE ?
+				(uint64_t)d->runs * (4 + d->width) :
+				hdr->rows * d->width;
+
+		if (d->width != export_cols[i].width ||
+		    d->encoding > TDX_CFG_COL_RLE || d->size != size ||
+		    d->offset > st.st_size || d->size > st.st_size - d->offset) {
+			printf("error: '%s' is corrupted.\n", file);
+			ret = CMD_RET_FAILURE;
+			goto out;
+		}
+	}
+
+	for (int i = 0; i < ncols; i++) {
+		const struct tdx_col_desc *d = &desc[cols[i]];
+		struct col_cursor *c = &cur[cols[i]];
+
+		c->p = map + d->offset;
+		c->end = c->p + d->size;
+		c->width = d->width;
+		c->rle = d->encoding == TDX_CFG_COL_RLE;
+		c->left = 0;
+	}
+
+	/* Advance all columns together by the shortest run left */
+	while (rows < hdr->rows) {
+		uint64_t key = 0, n = hdr->rows - rows;
+
+		for (int i = 0; i < ncols; i++) {
+			struct col_cursor *c = &cur[cols[i]];
+
+			if (!c->left && col_next(c)) {
+				printf("error: '%s' is corrupted.\n", file);
+				ret = CMD_RET_FAILURE;
+				goto out;
+			}
+			if (c->left < n)
+				n = c->left;
+		}
+
+		for (int i = 0; i < nby; i++)
+			key = key << agg_bits(by[i]) |
+			      (agg_value(cur, by[i]) &
+			       ((1ULL << agg_bits(by[i])) - 1));
+
+		if (agg_add(&table, key, n)) {
+			printf("error: out of memory.\n");
+			ret = CMD_RET_FAILURE;
+			goto out;
+		}
+
+		for (int i = 0; i < ncols; i++)
+			cur[cols[i]].left -= n;
+		rows += n;
+	}
+
+	/* Compact the table in place and print it in key order */
+	{
+		size_t n = 0;
+
+		for (size_t i = 0; i < table.size; i++) {
+			if (table.slots[i].key) {
+				table.slots[n] = table.slots[i];
+				table.slots[n++].key--;
+			}
+		}
+		qsort(table.slots, n, sizeof(*table.slots), agg_entry_cmp);
+
+		for (size_t i = 0; i < n; i++)
+			agg_print(by, nby, print_type, table.slots[i].key,
+				  table.slots[i].count);
+	}
+
+out:
+	free(table.slots);
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	return ret;
+}
+
+/*
+ * Daemon mode keeps every config block in memory and answers queries on a
+ * Unix socket, so frequent lookups don't pay for a process spawn and a device
+ * probe each. The protocol is line based, one request per line:
+ *
+ *   GET <field>                -> OK <value> | ERR <reason>
+ *   PRINT                      -> <field>="<value>" lines, then OK
+ *   RELOAD                     -> re-read all devices (root only), then OK
+ *   CREATE [carrier] <barcode> -> write a new block (root only), then OK
+ *
+ * Field names are the ones used by `print`. Clients are non-blocking and
+ * replies are queued per connection; a client that lets more than
+ * TDX_CFG_DAEMON_OUT_MAX bytes of replies pile up without reading them is
+ * dropped, so it can't stall the daemon for everyone else.
+ */
+#define TDX_CFG_DAEMON_SOCKET		"/run/tdx-cfgblock.sock"
+#define TDX_CFG_DAEMON_MAX_CLIENTS	16
+#define TDX_CFG_DAEMON_LINE_MAX		128
+#define TDX_CFG_DAEMON_OUT_MAX		4096
+
+struct cfgblock_state {
+	struct tdx_data data[TDX_EEPROM_ID_COUNT];
+	int valid[TDX_EEPROM_ID_COUNT];
+	struct tdx_field fields[TDX_EEPROM_ID_COUNT * TDX_FIELDS_PER_BLOCK];
+	int nfields;
+};
+
+struct cfgblock_conn {
+	int fd;
+	size_t len;
+	char buf[TDX_CFG_DAEMON_LINE_MAX];
+	size_t out_len;
+	char out[TDX_CFG_DAEMON_OUT_MAX];
+};
+
+/* Load all blocks, from the devices rather than the cache with reread */
+static void cfgblock_state_refresh(struct cfgblock_state *st, int reread)
+{
+	cache_refresh = reread;
+	load_all_tdx_data(st->data, st->valid);
+	cache_refresh = 0;
+
+	st->nfields = 0;
+	for (u32 type = 0; type < TDX_EEPROM_ID_COUNT; type++) {
+		if (!st->valid[type])
+			continue;
+		format_tdx_data(type, &st->data[type], &st->fields[st->nfields]);
+		st->nfields += TDX_FIELDS_PER_BLOCK;
+	}
+}
+
+static const char *cfgblock_state_get(const struct cfgblock_state *st,
+	const char *name)
+{
+	for (int i = 0; i < st->nfields; i++) {
+		if (!strcmp(st->fields[i].name, name))
+			return st->fields[i].value;
+	}
+
+	return NULL;
+}
+
+static int send_line(int fd, const char *fmt, ...)
+{
+	char line[TDX_FIELD_NAME_LEN + TDX_FIELD_VALUE_LEN + 8];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (len >= sizeof(line))
+		len = sizeof(line) - 1;
+
+	if (send(fd, line, len, MSG_NOSIGNAL) != len)
+		return -EIO;
+
+	return 0;
+}
+
+/* Queue a reply line, -ENOBUFS if the client doesn't keep up */
+static int conn_send(struct cfgblock_conn *conn, const char *fmt, ...)
+{
+	size_t room = sizeof(conn->out) - conn->out_len;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(conn->out + conn->out_len, room, fmt, ap);
+	va_end(ap);
+
+	if (len >= room)
+		return -ENOBUFS;
+	conn->out_len += len;
+
+	return 0;
+}
+
+/* Send as much of the queued replies as the socket takes */
+static int conn_flush(struct cfgblock_conn *conn)
+{
+	ssize_t n;
+
+	while (conn->out_len) {
+		n = send(conn->fd, conn->out, conn->out_len,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n == -1)
+			return errno == EAGAIN || errno == EINTR ? 0 : -EIO;
+		conn->out_len -= n;
+		memmove(conn->out, conn->out + n, conn->out_len);
+	}
+
+	return 0;
+}
+
+/* Requests touching the devices are reserved to root, the socket is 0666 */
+static int conn_is_root(struct cfgblock_conn *conn)
+{
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+
+	return !getsockopt(conn->fd, SOL_SOCKET, SO_PEERCRED, &cred,
+			   &cred_len) && cred.uid == 0;
+}
+
+static int cfgblock_daemon_create(struct cfgblock_state *st,
+	struct cfgblock_conn *conn, char *args)
+{
+	struct nv_handle h;
+	u32 type = TDX_EEPROM_ID_MODULE;
+	char *barcode = args;
+	int ret;
+
+	if (!conn_is_root(conn))
+		return conn_send(conn, "ERR permission denied\n");
+
+	if (!strncmp(barcode, "carrier ", 8)) {
+		type = TDX_EEPROM_ID_CARRIER;
+		barcode += 8;
+	}
+
+	if (first_valid_nv_dev(type, O_RDWR, &h))
+		return conn_send(conn, "ERR no device\n");
+
+	if (type == TDX_EEPROM_ID_CARRIER)
+		ret = do_cfgblock_carrier_create(&h, 1, barcode);
+	else
+		ret = do_cfgblock_create(&h, 1, barcode);
+	nv_close(&h);
+
+	cfgblock_state_refresh(st, 1);
+
+	if (ret)
+		return conn_send(conn, "ERR write failed\n");
+
+	return conn_send(conn, "OK\n");
+}
+
+static int cfgblock_daemon_handle(struct cfgblock_state *st,
+	struct cfgblock_conn *conn, char *line)
+{
+	const char *value;
+
+	if (!strncmp(line, "GET ", 4)) {
+		value = cfgblock_state_get(st, line + 4);
+		if (!value)
+			return conn_send(conn, "ERR unknown field\n");
+		return conn_send(conn, "OK %s\n", value);
+	} else if (!strcmp(line, "PRINT")) {
+		for (int i = 0; i < st->nfields; i++) {
+			if (conn_send(conn, "%s=\"%s\"\n", st->fields[i].name,
+				      st->fields[i].value))
+				return -ENOBUFS;
+		}
+		return conn_send(conn, "OK\n");
+	} else if (!strcmp(line, "RELOAD")) {
+		/* Re-reads every device on the bus, don't let anyone loop it */
+		if (!conn_is_root(conn))
+			return conn_send(conn, "ERR permission denied\n");
+		cfgblock_state_refresh(st, 1);
+		return conn_send(conn, "OK\n");
+	} else if (!strncmp(line, "CREATE ", 7)) {
+		return cfgblock_daemon_create(st, conn, line + 7);
+	}
+
+	return conn_send(conn, "ERR unknown command\n");
+}
+
+/* Process every complete line received so far, returns -1 to drop the conn */
+static int cfgblock_daemon_input(struct cfgblock_state *st,
+	struct cfgblock_conn *conn)
+{
+	ssize_t n;
+	char *eol;
+
+	n = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+	if (n <= 0)
+		return -1;
+	conn->len += n;
+
+	while ((eol = memchr(conn->buf, '\n', conn->len))) {
+		size_t line_len = eol - conn->buf + 1;
+
+		*eol = '\0';
+		if (eol > conn->buf && eol[-1] == '\r')
+			eol[-1] = '\0';
+
+		if (cfgblock_daemon_handle(st, conn, conn->buf))
+			return -1;
+
+		conn->len -= line_len;
+		memmove(conn->buf, conn->buf + line_len, conn->len);
+	}
+
+	/* A line that doesn't fit the buffer is a protocol error */
+	if (conn->len == sizeof(conn->buf))
+		return -1;
+
+	return conn_flush(conn);
+}
+
+static int do_cfgblock_daemon(const char *path)
+{
+	struct cfgblock_state st;
+	struct cfgblock_conn conns[TDX_CFG_DAEMON_MAX_CLIENTS];
+	struct pollfd pfds[TDX_CFG_DAEMON_MAX_CLIENTS + 1];
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int lfd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("error: socket path too long.\n");
+		return CMD_RET_FAILURE;
+	}
+	strcpy(addr.sun_path, path);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd == -1) {
+		printf("error: cannot create socket.\n");
+		return CMD_RET_FAILURE;
+	}
+
+	unlink(path);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(path, 0666) || listen(lfd, TDX_CFG_DAEMON_MAX_CLIENTS)) {
+		printf("error: cannot listen on '%s'.\n", path);
+		close(lfd);
+		return CMD_RET_FAILURE;
+	}
+
+	cfgblock_state_refresh(&st, 0);
+
+	for (int i = 0; i < ARRAY_SIZE(conns); i++)
+		conns[i].fd = -1;
+
+	for (;;) {
+		pfds[0].fd = lfd;
+		pfds[0].events = POLLIN;
+		for (int i = 0; i < ARRAY_SIZE(conns); i++) {
+			pfds[i + 1].fd = conns[i].fd;
+			pfds[i + 1].events = POLLIN |
+					     (conns[i].out_len ? POLLOUT : 0);
+		}
+
+		if (poll(pfds, ARRAY_SIZE(pfds), -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < ARRAY_SIZE(conns); i++) {
+			if (conns[i].fd == -1 || !pfds[i + 1].revents)
+				continue;
+
+			if ((pfds[i + 1].revents & POLLOUT &&
+			     conn_flush(&conns[i])) ||
+			    (pfds[i + 1].revents & ~POLLOUT &&
+			     cfgblock_daemon_input(&st, &conns[i]))) {
+				close(conns[i].fd);
+				conns[i].fd = -1;
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int fd = accept4(lfd, NULL, NULL,
+					 SOCK_CLOEXEC | SOCK_NONBLOCK);
+			int i;
+
+			if (fd == -1)
+				continue;
+
+			for (i = 0; i < ARRAY_SIZE(conns); i++) {
+				if (conns[i].fd == -1)
+					break;
+			}
+
+			if (i == ARRAY_SIZE(conns)) {
+				close(fd);
+				continue;
+			}
+
+			conns[i].fd = fd;
+			conns[i].len = 0;
+			conns[i].out_len = 0;
+		}
+	}
+
+	close(lfd);
+	return CMD_RET_FAILURE;
+}
+
+/* Daemon connection of a client, with what was read past the last reply */
+struct cfgblock_client {
+	int fd;
+	size_t len;
+	char buf[TDX_CFG_DAEMON_LINE_MAX];
+};
+
+/* Send one request and read back a single reply line */
+static int cfgblock_query(struct cfgblock_client *c, const char *request,
+	char *reply, size_t size)
+{
+	size_t line_len;
+	ssize_t n;
+	char *eol;
+
+	if (send_line(c->fd, "%s\n", request))
+		return -EIO;
+
+	while (!(eol = memchr(c->buf, '\n', c->len))) {
+		if (c->len == sizeof(c->buf))
+			return -EIO;
+		n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+		if (n <= 0)
+			return -EIO;
+		c->len += n;
+	}
+
+	line_len = eol - c->buf;
+	memcpy(reply, c->buf, line_len < size ? line_len : size - 1);
+	reply[line_len < size ? line_len : size - 1] = '\0';
+	c->len -= line_len + 1;
+	memmove(c->buf, eol + 1, c->len);
+
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Time `count` round trips of the first query and report throughput and
+ * latency percentiles on stderr.
+ */
+static int cfgblock_query_bench(struct cfgblock_client *c,
+	const char *request, int count)
+{
+	char reply[TDX_CFG_DAEMON_LINE_MAX];
+	struct timespec start, t0, t1;
+	double *lat, total;
+
+	lat = malloc(count * sizeof(*lat));
+	if (!lat)
+		return -ENOMEM;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (cfgblock_query(c, request, reply, sizeof(reply))) {
+			free(lat);
+			return -EIO;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		lat[i] = (t1.tv_sec - t0.tv_sec) * 1e6 +
+			 (t1.tv_nsec - t0.tv_nsec) / 1e3;
+	}
+	total = (t1.tv_sec - start.tv_sec) + (t1.tv_nsec - start.tv_nsec) / 1e9;
+
+	qsort(lat, count, sizeof(*lat), cmp_double);
+	fprintf(stderr, "queries=%d qps=%.0f p50=%.1fus p99=%.1fus max=%.1fus\n",
+		count, count / total, lat[count / 2], lat[count * 99 / 100],
+		lat[count - 1]);
+
+	free(lat);
+	return 0;
+}
+
+/*
+ * Print the value of each requested field, one per line. Without a running
+ * daemon the devices are read directly.
+ */
+static int do_cfgblock_query(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *path = TDX_CFG_DAEMON_SOCKET;
+	char request[TDX_CFG_DAEMON_LINE_MAX];
+	char reply[TDX_CFG_DAEMON_LINE_MAX];
+	struct cfgblock_client c = { .len = 0 };
+	struct cfgblock_state st;
+	int bench = 0, nfields = 0, fd, ret = CMD_RET_SUCCESS;
+	char **fields = argv;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--socket") && i + 1 < argc)
+			path = argv[++i];
+		else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+			bench = atoi(argv[++i]);
+		else
+			fields[nfields++] = argv[i];
+	}
+
+	if (!nfields) {
+		printf("error: no field given.\n");
+		return CMD_RET_USAGE;
+	}
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		fd = -1;
+	}
+
+	if (fd == -1) {
+		if (bench) {
+			printf("error: cannot connect to '%s'.\n", path);
+			return CMD_RET_FAILURE;
+		}
+		cfgblock_state_refresh(&st, 0);
+	}
+	c.fd = fd;
+
+	for (int i = 0; i < nfields; i++) {
+		const char *value;
+
+		if (fd == -1) {
+			value = cfgblock_state_get(&st, fields[i]);
+		} else {
+			snprintf(request, sizeof(request), "GET %s", fields[i]);
+			if (cfgblock_query(&c, request, reply, sizeof(reply))) {
+				printf("error: daemon connection lost.\n");
+				ret = CMD_RET_FAILURE;
+				break;
+			}
+			value = strncmp(reply, "OK ", 3) ? NULL : reply + 3;
+		}
+
+		if (!value) {
+			printf("error: unknown field '%s'.\n", fields[i]);
+			ret = CMD_RET_FAILURE;
+			continue;
+		}
+		printf("%s\n", value);
+	}
+
+	if (fd != -1 && bench > 0) {
+		snprintf(request, sizeof(request), "GET %s", fields[0]);
+		if (cfgblock_query_bench(&c, request, bench))
+			ret = CMD_RET_FAILURE;
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	return ret;
+}
+
+/*
+ * Micro-benchmarks, for tuning and regression checks rather than for use on
+ * a board.
+ *
+ *   bench tlv [--type t] [count]
+ *
+ * decodes `count` generated blocks (every 16th blank, every 64th with an
+ * extra tag in front) with the per-block parser and with every batch kernel
+ * this CPU supports, checks that they agree and reports blocks per second.
+ */
+#define TDX_BENCH_TLV_BLOCKS	1000000
+#define TDX_BENCH_RUNS		5
+
+static void bench_tlv_fill(u8 *blocks, size_t stride, size_t count, u32 type)
+{
+	struct tdx_data data;
+
+	memset(&data, 0, sizeof(data));
+	data.hw_tag.prodid = data.car_hw_tag.prodid = 55;
+	data.hw_tag.ver_major = data.car_hw_tag.ver_major = 1;
+
+	for (size_t i = 0; i < count; i++) {
+		u8 *b = blocks + i * stride;
+		int offset = 4;
+
+		data.serial = data.car_serial = 6000000 + i;
+		if (type == TDX_EEPROM_ID_MODULE)
+			tdx_encode_cfg_block(b, stride, &data);
+		else
+			tdx_encode_cfg_block_carrier(b, stride, &data);
+
+		if (i % 16 == 15) {
+			memset(b, 0xff, stride);
+		} else if (i % 64 == 7) {
+			/* Unknown tag ahead of the others, same content */
+			memmove(b + 8, b + 4, stride - 8);
+			tdx_write_tag(b, &offset, 0x4000, NULL, 0);
+		}
+	}
+}
+
+static double bench_tlv_parse(const u8 *blocks, size_t stride, size_t count,
+	u32 type, struct tdx_data *data, int *ret)
+{
+	u32 want = tdx_data_want_all(type);
+	struct timespec start;
+	size_t need;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < count; i++) {
+		memset(&data[i], 0, sizeof(data[i]));
+		ret[i] = tdx_parse_cfg_block(blocks + i * stride, stride,
+					     stride, want, &data[i], &need);
+	}
+
+	return elapsed_ms(&start) / 1e3;
+}
+
+static int do_cfgblock_bench_tlv(int argc, char *argv[])
+{
+	size_t count = TDX_BENCH_TLV_BLOCKS, stride;
+	u32 type = TDX_EEPROM_ID_MODULE;
+	struct tdx_data *ref_data, *data;
+	int *ref_ret, *ret;
+	double secs, best, ref_rate = 0;
+	u8 *blocks;
+	int err = CMD_RET_SUCCESS;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--type") && i + 1 < argc) {
+			int t = tdx_type_from_name(argv[++i]);
+
+			if (t < 0) {
+				printf("error: unknown block type '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+			type = t;
+		} else {
+			count = strtoul(argv[i], NULL, 0);
+		}
+	}
+
+	if (!count) {
+		printf("error: invalid block count.\n");
+		return CMD_RET_USAGE;
+	}
+
+	stride = type == TDX_EEPROM_ID_MODULE ? TDX_CFG_BLOCK_MAX_SIZE :
+						TDX_CFG_BLOCK_EXTRA_MAX_SIZE;
+	blocks = malloc(count * stride);
+	ref_data = malloc(count * sizeof(*ref_data));
+	data = malloc(count * sizeof(*data));
+	ref_ret = malloc(count * sizeof(*ref_ret));
+	ret = malloc(count * sizeof(*ret));
+	if (!blocks || !ref_data || !data || !ref_ret || !ret) {
+		printf("error: out of memory.\n");
+		err = CMD_RET_FAILURE;
+		goto out;
+	}
+
+	bench_tlv_fill(blocks, stride, count, type);
+
+	best = 0;
+	for (int run = 0; run < TDX_BENCH_RUNS; run++) {
+		secs = bench_tlv_parse(blocks, stride, count, type, ref_data,
+				       ref_ret);
+		if (!run || secs < best)
+			best = secs;
+	}
+	ref_rate = count / best;
+	printf("impl=parse blocks=%zu rate=%.0f/s speedup=1.00\n", count,
+	       ref_rate);
+
+	for (int impl = 0; impl < ARRAY_SIZE(tdx_tlv_impl_name); impl++) {
+		struct timespec start;
+		size_t valid = 0;
+
+		if (!tdx_tlv_impl_supported(impl))
+			continue;
+
+		best = 0;
+		for (int run = 0; run < TDX_BENCH_RUNS; run++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			valid = tdx_decode_cfg_blocks(impl, blocks, stride,
+						      count, type, data, ret);
+			secs = elapsed_ms(&start) / 1e3;
+			if (!run || secs < best)
+				best = secs;
+		}
+
+		if (memcmp(data, ref_data, count * sizeof(*data)) ||
+		    memcmp(ret, ref_ret, count * sizeof(*ret))) {
+			printf("impl=%s error: results differ from parse\n",
+			       tdx_tlv_impl_name[impl]);
+			err = CMD_RET_FAILURE;
+			continue;
+		}
+
+		printf("impl=%s blocks=%zu valid=%zu rate=%.0f/s "
+		       "speedup=%.2f\n", tdx_tlv_impl_name[impl], count, valid,
+		       count / best, count / best / ref_rate);
+	}
+
+out:
+	free(blocks);
+	free(ref_data);
+	free(data);
+	free(ref_ret);
+	free(ret);
+	return err;
+}
+
+static int do_cfgblock_bench(int argc, char *argv[])
+{
+	if (argc >= 1 && !strcmp(argv[0], "tlv"))
+		return do_cfgblock_bench_tlv(argc - 1, argv + 1);
+
+	printf("error: usage: bench tlv [--type t] [count]\n");
+	return CMD_RET_USAGE;
+}
+
+static int do_cfgblock_display_list()
+{
+	for (int i = 0; i < toradex_display_adapters_count; i++)
+		printf("%04d\t%s\n", toradex_display_adapters[i].pid4,
+							toradex_display_adapters[i].name);
+
+	return CMD_RET_SUCCESS;
+}
+
+static int do_cfgblock_carrier_list()
+{
+	for (int i = 0; i < toradex_carrier_boards_count; i++)
+		printf("%04d\t%s\n", toradex_carrier_boards[i].pid4,
+							toradex_carrier_boards[i].name);
+
+	return CMD_RET_SUCCESS;
+}
+
+static int do_cfgblock_list()
+{
+	for (int i = 0; i < toradex_modules_enabled_count; i++)
+		printf("%04d\t%s\n", toradex_modules_enabled[i],
+		       toradex_modules[toradex_modules_enabled[i]].name);
+
+	return CMD_RET_SUCCESS;
+}
+
+#define TDX_CFG_SEARCH_MAX	10000	/* one per pid4 */
+
+static int do_cfgblock_search_list(u32 type, const char *query)
+{
+	int pid4s[TDX_CFG_SEARCH_MAX];
+	unsigned int i, n;
+	const char *name;
+
+	n = tdx_product_search(type, query, pid4s, ARRAY_SIZE(pid4s));
+	if (n > ARRAY_SIZE(pid4s))
+		n = ARRAY_SIZE(pid4s);
+
+	for (i = 0; i < n; i++) {
+		if (type == TDX_EEPROM_ID_MODULE)
+			name = toradex_modules[pid4s[i]].name;
+		else if (type == TDX_EEPROM_ID_CARRIER)
+			name = tdx_get_carrier_boards(pid4s[i]);
+		else
+			name = tdx_get_display_adapters(pid4s[i]);
+		printf("%04d\t%s\n", pid4s[i], name);
+	}
+
+	return n ? CMD_RET_SUCCESS : CMD_RET_FAILURE;
+}
+
+static void usage()
+{
+	printf("Toradex config block handling commands\n"
+	"create [-y] [barcode]         - (Re-)create Toradex config block\n"
+	"create carrier [-y] [barcode] - (Re-)create Toradex Carrier config block\n"
+	"batch [-y] [file]             - Create config blocks for every\n"
+	"                                \"<target>[@offset] <module|carrier> <barcode>\"\n"
+	"                                record read from file or stdin\n"
+	"gang-create [-y] [file]       - Like batch, writing the devices on\n"
+	"                                different buses in parallel and reading\n"
+	"                                every block back to verify it\n"
+	"generate [-j n] [--bench] prodid+rev first last [file|dir]\n"
+	"                              - Encode module blocks for a serial range\n"
+	"                                (e.g. 00551101 06000000 06099999) into a\n"
+	"                                packed file or one blob per serial in dir\n"
+	"scan [-j n] [--csv] [--type t] [--stride n] dir|file...\n"
+	"                              - Decode config block dumps, one per file or\n"
+	"                                concatenated, as JSON Lines or CSV\n"
+	"validate-barcodes [--type t] [file...]\n"
+	"                              - Check one barcode per line of an order\n"
+	"                                sheet, reporting bad lines by number\n"
+	"dedup [-j n] [--type t] [--format f] [--mem MiB] [--tmpdir dir] inputs\n"
+	"                              - Report serials/MACs found more than once\n"
+	"                                in block dumps, barcode lists or scan output\n"
+	"index build [-o file] [--type t] dir|file...\n"
+	"                              - Write a sorted MAC/serial index from scan or\n"
+	"                                generate output or barcode lists (default\n"
+	"                                tdx-cfgblock.idx)\n"
+	"index lookup [-f file] mac|serial...\n"
+	"                              - Print the product behind a MAC or serial\n"
+	"export --columnar -o file [--type t] dir|file...\n"
+	"                              - Write blocks, scan output or barcode lists\n"
+	"                                as a compact column per field, run-length\n"
+	"                                encoded\n"
+	"aggregate [--by type,prodid,rev,oui] file\n"
+	"                              - Count the rows of a columnar export per\n"
+	"                                group (default prodid,rev)\n"
+	"set [carrier|display] field=value...\n"
+	"                              - Update fields in place (prodid, rev,\n"
+	"                                ver_major, ver_minor, ver_assembly, serial)\n"
+	"print                         - Print Toradex config block in flash\n"
+	"print carrier                 - Print Toradex Carrier config block in flash\n"
+	"print display                 - Print Toradex Display Adapter config block\n"
+	"print [carrier|display] field - Print a single field, reading only the tags\n"
+	"                                it needs\n"
+	"print all                     - Print all config blocks, read concurrently\n"
+	"dump [carrier|display]        - Print every tag of a config block, known\n"
+	"                                or not, with its payload in hex\n"
+	"get [carrier|display] [--binary] tag-id\n"
+	"                              - Print the payload of one tag (e.g. 0x0008)\n"
+	"                                in hex or as raw bytes\n"
+	"list                          - Print supported module IDs and name\n"
+	"list carrier                  - Print supported carrier IDs and name\n"
+	"list display                  - Print supported display adapter IDs and name\n"
+	"list [carrier|display] --search words\n"
+	"                              - Print the products with a name word starting\n"
+	"                                with each of words (e.g. \"imx8mp 4gb\")\n"
+	"cache stats                   - Print config block cache hit/miss counters\n"
+	"cache clear                   - Drop all cached config blocks and the\n"
+	"                                device map\n"
+	"devices [rescan]              - Print the devices searched for config\n"
+	"                                blocks, from " TDX_CFG_CONF_FILE "\n"
+	"                                and sysfs\n"
+	"bench tlv [--type t] [count]  - Compare batch block decoding kernels with\n"
+	"                                the per-block parser\n"
+	"daemon [socket]               - Serve config block fields on a Unix socket\n"
+	"query [--socket path] [--bench n] field...\n"
+	"                              - Print fields, from the daemon if running\n"
+	"\n"
+	"Options:\n"
+	"--no-cache                    - Bypass the config block cache in "
+	TDX_CFG_CACHE_DIR "\n"
+	"--stats[=text|json]           - Print device I/O counters and the time\n"
+	"                                spent per phase and device to stderr\n"
+	"--io auto|sync|uring          - Read the devices of devices rescan and\n"
+	"                                print all (with --no-cache) in one\n"
+	"                                io_uring batch or one after the other\n"
+	"                                (default auto: io_uring if available)\n"
+	"--page-size n                 - EEPROM page size for partial writes "
+	"(default 16)\n"
+	"--image file                  - Operate on an image file instead of the\n"
+	"                                board devices (print, create, set)\n"
+	"--offset n                    - Config block offset in the image\n"
+	"--size n                      - Config block size in the image\n");
+}
+
+static int do_command(int nargs, char *args[])
+{
+	int ret, i;
+	int carrier = 0, display = 0, all = 0, force_overwrite = 0;
+	char *barcode = NULL, *search = NULL;
+	struct nv_handle h;
+	u32 type;
+
+	if (nargs < 2) {
+		usage();
+		return CMD_RET_USAGE;
+	}
+
+	for (i=2; i<nargs; ++i) {
+		if (!strcmp(args[i], "carrier")) {
+			carrier = 1;
+		} else if (!strcmp(args[i], "display")) {
+			display = 1;
+		} else if (!strcmp(args[i], "all")) {
+			all = 1;
+		} else if (!strcmp(args[i], "-y")) {
+			force_overwrite = 1;
+		} else if (!strcmp(args[i], "--search") && i + 1 < nargs) {
+			search = args[++i];
+		} else {
+			barcode = args[i];
+		}
+	}
+
+	if (display)
+		type = TDX_EEPROM_ID_DISPLAY_ADAPTER;
+	else if (carrier)
+		type = TDX_EEPROM_ID_CARRIER;
+	else
+		type = TDX_EEPROM_ID_MODULE;
+
+	if (!strcmp(args[1], "create")) {
+		if (display) {
+			usage();
+			return CMD_RET_USAGE;
+		}
+
+		if (first_valid_nv_dev(type, O_RDWR, &h))
+			return -ENODEV;
+
+		if (carrier)
+			ret = do_cfgblock_carrier_create(&h, force_overwrite, barcode);
+		else
+			ret = do_cfgblock_create(&h, force_overwrite, barcode);
+
+		nv_close(&h);
+		return ret;
+	} else if (!strcmp(args[1], "batch")) {
+		return do_cfgblock_batch(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "gang-create")) {
+		return do_cfgblock_gang_create(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "generate")) {
+		return do_cfgblock_generate(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "scan")) {
+		return do_cfgblock_scan(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "validate-barcodes")) {
+		return do_cfgblock_validate_barcodes(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "dedup")) {
+		return do_cfgblock_dedup(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "index")) {
+		return do_cfgblock_index(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "export")) {
+		return do_cfgblock_export(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "aggregate")) {
+		return do_cfgblock_aggregate(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "set")) {
+		if (first_valid_nv_dev(type, O_RDWR, &h))
+			return -ENODEV;
+
+		ret = do_cfgblock_set(&h, nargs - 2, args + 2);
+		nv_close(&h);
+		return ret;
+	} else if (!strcmp(args[1], "print")) {
+		if (all && image_dev.path) {
+			printf("error: print all is not supported with --image.\n");
+			return CMD_RET_USAGE;
+		}
+
+		if (all)
+			return do_cfgblock_print_all();
+
+		if (first_valid_nv_dev(type, O_RDONLY, &h))
+			return -ENODEV;
+
+		/* For print, the optional argument selects a single field */
+		ret = do_cfgblock_print(&h, barcode);
+		nv_close(&h);
+		return ret;
+	} else if (!strcmp(args[1], "dump") || !strcmp(args[1], "get")) {
+		if (first_valid_nv_dev(type, O_RDONLY, &h))
+			return -ENODEV;
+
+		if (!strcmp(args[1], "dump"))
+			ret = do_cfgblock_dump(&h);
+		else
+			ret = do_cfgblock_get(&h, nargs - 2, args + 2);
+		nv_close(&h);
+		return ret;
+	} else if (!strcmp(args[1], "list")) {
+		if (search) {
+			return do_cfgblock_search_list(type, search);
+		} else if (display) {
+			return do_cfgblock_display_list();
+		} else if (carrier) {
+			return do_cfgblock_carrier_list();
+		} else {
+			return do_cfgblock_list();
+		}
+	} else if (!strcmp(args[1], "daemon")) {
+		if (image_dev.path) {
+			printf("error: daemon is not supported with --image.\n");
+			return CMD_RET_USAGE;
+		}
+
+		return do_cfgblock_daemon(nargs > 2 ? args[2] :
+					  TDX_CFG_DAEMON_SOCKET);
+	} else if (!strcmp(args[1], "devices")) {
+		return do_cfgblock_devices(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "query")) {
+		return do_cfgblock_query(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "bench")) {
+		return do_cfgblock_bench(nargs - 2, args + 2);
+	} else if (!strcmp(args[1], "cache")) {
+		if (barcode && !strcmp(barcode, "stats"))
+			return do_cfgblock_cache_stats();
+		else if (barcode && !strcmp(barcode, "clear"))
+			return do_cfgblock_cache_clear();
+	}
+
+	usage();
+	return CMD_RET_USAGE;
+}
+
+/* --stats output, one line per phase and probe or a single JSON object */
+static void stats_json_string(const char *s)
+{
+	fputc('"', stderr);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(stderr, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(stderr, "\\u%04x", *s);
+		else
+			fputc(*s, stderr);
+	}
+	fputc('"', stderr);
+}
+
+static void stats_report(const char *command, int ret, double total_ms)
+{
+	unsigned int probes = probe_count < TDX_STATS_PROBES_MAX ?
+			      probe_count : TDX_STATS_PROBES_MAX;
+	const char *sep = "";
+
+	if (stats_mode == STATS_TEXT) {
+		fprintf(stderr, "io_opens=%lu io_reads=%lu io_bytes_read=%lu "
+			"io_writes=%lu io_bytes_written=%lu io_syscalls=%lu\n",
+			nv_stats.opens, nv_stats.reads, nv_stats.bytes_read,
+			nv_stats.writes, nv_stats.bytes_written,
+			nv_stats.syscalls);
+		for (int i = 0; i < PHASE_COUNT; i++) {
+			if (phase_stats[i].calls)
+				fprintf(stderr, "phase=%s calls=%lu time=%.3fms\n",
+					phase_name[i], phase_stats[i].calls,
+					phase_stats[i].ns / 1e6);
+		}
+		for (unsigned int i = 0; i < probes; i++)
+			fprintf(stderr, "probe path=\"%s\" type=%s result=\"%s\" "
+				"time=%.3fms\n", probe_stats[i].path,
+				nv_dev_type_name[probe_stats[i].type],
+				probe_stats[i].ret ?
+				strerror(-probe_stats[i].ret) : "ok",
+				probe_stats[i].ns / 1e6);
+		fprintf(stderr, "command=%s ret=%d time=%.3fms\n", command, ret,
+			total_ms);
+		return;
+	}
+
+	fprintf(stderr, "{\"command\":");
+	stats_json_string(command);
+	fprintf(stderr, ",\"ret\":%d,\"time_ms\":%.3f,\"io\":{\"opens\":%lu,"
+		"\"reads\":%lu,\"bytes_read\":%lu,\"writes\":%lu,"
+		"\"bytes_written\":%lu,\"syscalls\":%lu},\"phases\":{",
+		ret, total_ms, nv_stats.opens, nv_stats.reads,
+		nv_stats.bytes_read, nv_stats.writes, nv_stats.bytes_written,
+		nv_stats.syscalls);
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		if (!phase_stats[i].calls)
+			continue;
+		fprintf(stderr, "%s\"%s\":{\"calls\":%lu,\"time_ms\":%.3f}", sep,
+			phase_name[i], phase_stats[i].calls,
+			phase_stats[i].ns / 1e6);
+		sep = ",";
+	}
+	fprintf(stderr, "},\"probes\":[");
+	for (unsigned int i = 0; i < probes; i++) {
+		fprintf(stderr, "%s{\"path\":", i ? "," : "");
+		stats_json_string(probe_stats[i].path);
+		fprintf(stderr, ",\"type\":\"%s\",\"result\":",
+			nv_dev_type_name[probe_stats[i].type]);
+		stats_json_string(probe_stats[i].ret ?
+				  strerror(-probe_stats[i].ret) : "ok");
+		fprintf(stderr, ",\"time_ms\":%.3f}", probe_stats[i].ns / 1e6);
+	}
+	fprintf(stderr, "],\"probes_dropped\":%u}\n", probe_count - probes);
+}
+
+int main(int argc, char *const argv[])
+{
+	char *args[argc + 1];
+	struct timespec start;
+	int nargs = 1, ret;
+
+	args[0] = argv[0];
+
+	/* Global options may be given before or after the command */
+	for (int i=1; i<argc; ++i) {
+		if (!strcmp(argv[i], "--no-cache"))
+			use_cache = 0;
+		else if (!strcmp(argv[i], "--stats") ||
+			 !strcmp(argv[i], "--stats=text"))
+			stats_mode = STATS_TEXT;
+		else if (!strcmp(argv[i], "--stats=json"))
+			stats_mode = STATS_JSON;
+		else if (!strncmp(argv[i], "--stats=", 8)) {
+			printf("error: unknown --stats format '%s'.\n",
+			       argv[i] + 8);
+			return CMD_RET_USAGE;
+		}
+		else if (!strcmp(argv[i], "--io") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "auto"))
+				nv_io = NV_IO_AUTO;
+			else if (!strcmp(argv[i], "sync"))
+				nv_io = NV_IO_SYNC;
+			else if (!strcmp(argv[i], "uring"))
+				nv_io = NV_IO_URING;
+			else {
+				printf("error: unknown --io backend '%s'.\n",
+				       argv[i]);
+				return CMD_RET_USAGE;
+			}
+		}
+		else if (!strcmp(argv[i], "--page-size") && i + 1 < argc)
+			nv_page_size = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--image") && i + 1 < argc)
+			image_dev.path = argv[++i];
+		else if (!strcmp(argv[i], "--offset") && i + 1 < argc)
+			image_dev.offset = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+			image_dev.size = strtoul(argv[++i], NULL, 0);
+		else
+			args[nargs++] = argv[i];
+	}
+	args[nargs] = NULL;
+
+	if (nv_fake_init())
+		return CMD_RET_USAGE;
+
+	if (nv_page_size <= 0) {
+		printf("error: invalid page size.\n");
+		return CMD_RET_USAGE;
+	}
+
+	if (!image_dev.path && (image_dev.offset || image_dev.size)) {
+		printf("error: --offset and --size need --image.\n");
+		return CMD_RET_USAGE;
+	}
+
+	if (image_dev.size > TDX_CFG_BLOCK_BUF_SIZE ||
+	    (image_dev.size && image_dev.size < TDX_CFG_BLOCK_MIN_SIZE)) {
+		printf("error: --size must be %d to %d bytes.\n",
+		       TDX_CFG_BLOCK_MIN_SIZE, TDX_CFG_BLOCK_BUF_SIZE);
+		return CMD_RET_USAGE;
+	}
+
+	/* Images are often modified by other tools, never cache them */
+	if (image_dev.path)
+		use_cache = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = do_command(nargs, args);
+
+	if (stats_mode) {
+		fflush(stdout);
+		stats_report(nargs > 1 ? args[1] : "", ret,
+			     elapsed_ms(&start));
+	}
+
+	return ret;
+}
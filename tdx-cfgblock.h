@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * libtdxcfgblock - decode and encode Toradex config blocks
+ *
+ * All functions work on caller provided buffers. They don't allocate, don't
+ * do I/O, don't print and keep no state between calls, so they can be called
+ * from any number of threads at once.
+ */
+
+#ifndef _TDX_CFG_BLOCK_H
+#define _TDX_CFG_BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct toradex_hw {
+	uint16_t ver_major;
+	uint16_t ver_minor;
+	uint16_t ver_assembly;
+	uint16_t prodid;
+};
+
+struct toradex_eth_addr {
+	uint32_t oui:24;
+	uint32_t nic:24;
+} __attribute__((__packed__));
+
+struct toradex_som {
+	const char *name;
+	int is_enabled;
+};
+
+struct tdx_pid4list {
+	int pid4;
+	char * const name;
+};
+
+struct toradex_tag {
+	uint32_t len:14;
+	uint32_t flags:2;
+	uint32_t id:16;
+};
+
+#define TDX_TAG_VALID		0xcf01
+#define TDX_TAG_MAC		0x0000
+#define TDX_TAG_CAR_SERIAL	0x0021
+#define TDX_TAG_HW		0x0008
+#define TDX_TAG_INVALID		0xffff
+
+#define TDX_TAG_FLAG_VALID	0x1
+
+/* Tags to decode when reading a config block */
+#define TDX_WANT_HW		(1 << 0)
+#define TDX_WANT_MAC		(1 << 1)
+#define TDX_WANT_CAR_HW		(1 << 2)
+#define TDX_WANT_CAR_SERIAL	(1 << 3)
+#define TDX_WANT_MODULE		(TDX_WANT_HW | TDX_WANT_MAC)
+#define TDX_WANT_CARRIER	(TDX_WANT_CAR_HW | TDX_WANT_CAR_SERIAL)
+
+/* Config block types */
+#define TDX_EEPROM_ID_MODULE		0
+#define TDX_EEPROM_ID_CARRIER		1
+#define TDX_EEPROM_ID_DISPLAY_ADAPTER	2
+#define TDX_EEPROM_ID_COUNT		3
+
+/* Buffer size for tdx_get_board_assembly_r(), "A".."Z" or "#26".."#65535" */
+#define TDX_ASSEMBLY_STR_LEN	7
+
+struct tdx_data {
+	struct toradex_hw hw_tag;
+	struct toradex_hw car_hw_tag;
+	struct toradex_eth_addr eth_addr;
+	uint32_t serial;
+	uint32_t car_serial;
+};
+
+/*
+ * Product tables, generated from tdx-cfgdata.txt. toradex_modules[] is indexed
+ * by product id, toradex_modules_enabled[] lists the ids create accepts.
+ */
+extern const struct toradex_som toradex_modules[];
+extern const unsigned int toradex_modules_count;
+extern const uint16_t toradex_modules_enabled[];
+extern const unsigned int toradex_modules_enabled_count;
+extern const struct tdx_pid4list toradex_carrier_boards[];
+extern const unsigned int toradex_carrier_boards_count;
+extern const struct tdx_pid4list toradex_display_adapters[];
+extern const unsigned int toradex_display_adapters_count;
+
+/* Name of a carrier board or display adapter, "UNKNOWN ..." if not listed */
+const char *tdx_get_carrier_boards(int pid4);
+const char *tdx_get_display_adapters(int pid4);
+
+/*
+ * Products of `type` (TDX_EEPROM_ID_*) with every word of query, case
+ * insensitive, starting one of the words of their name. Up to max pid4s go
+ * to pid4s in ascending order; the number of matches is returned. An empty
+ * query matches all enabled modules, carrier boards or display adapters.
+ */
+unsigned int tdx_product_search(uint32_t type, const char *query, int *pid4s,
+				unsigned int max);
+
+/* Assembly revision letter(s) into buf, which is returned */
+char *tdx_get_board_assembly_r(uint16_t ver_assembly, char *buf, size_t size);
+
+/*
+ * Serial number <-> MAC address. tdx_get_mac_from_serial() returns -ERANGE
+ * for a serial without a known OUI and uses the first OUI then.
+ */
+uint32_t tdx_get_serial_from_mac(const struct toradex_eth_addr *eth_addr);
+int tdx_get_mac_from_serial(uint32_t tdx_serial,
+			    struct toradex_eth_addr *eth_addr);
+
+/* Problems found by tdx_barcode_decode() and tdx_barcode_check() */
+enum {
+	TDX_BARCODE_OK,
+	TDX_BARCODE_LENGTH,
+	TDX_BARCODE_DIGITS,
+	TDX_BARCODE_PRODID,
+	TDX_BARCODE_REVISION,
+	TDX_BARCODE_SERIAL,
+	TDX_BARCODE_ERROR_COUNT,
+};
+
+extern const char * const tdx_barcode_error[TDX_BARCODE_ERROR_COUNT];
+
+/*
+ * Decode a barcode of exactly 16 decimal digits, "ppppMmaa" then an 8 digit
+ * serial, into hw and serial. Returns TDX_BARCODE_OK or the problem found.
+ */
+int tdx_barcode_decode(const char *barcode, size_t len, struct toradex_hw *hw,
+		       uint32_t *serial);
+
+/*
+ * Check a decoded barcode of a TDX_EEPROM_ID_* type: the product must be
+ * known (and enabled for modules), the version at least V1.0 and a module
+ * serial must map to one of the known OUIs.
+ */
+int tdx_barcode_check(uint32_t type, const struct toradex_hw *hw,
+		      uint32_t serial);
+
+/* TDX_WANT_* mask decoding everything a block of `type` holds */
+uint32_t tdx_data_want_all(uint32_t type);
+
+/*
+ * Walk the TLV chain of a config block of `size` bytes, of which only the
+ * first `avail` have been fetched into config_block so far. The walk stops as
+ * soon as every tag selected by `want` has been decoded. When it runs out of
+ * fetched bytes it returns -EAGAIN with *need set to how many bytes of the
+ * block it wants to have; the caller fetches them and calls it again. An
+ * invalid header gives -EINVAL, a block without any of the wanted tags
+ * -ENOENT.
+ */
+int tdx_parse_cfg_block(const uint8_t *config_block, size_t avail,
+	size_t size, uint32_t want, struct tdx_data *data, size_t *need);
+
+/*
+ * Payload offset of the first valid tag `id`, following the same walk as
+ * tdx_parse_cfg_block() over the first `avail` fetched bytes of a `size` byte
+ * block. Returns -ENOENT when there is no such tag or its payload is too
+ * short for `payload_len` bytes.
+ */
+int tdx_find_tag(const uint8_t *config_block, size_t avail, size_t size,
+	uint16_t id, size_t payload_len);
+
+/*
+ * Index of every tag of a block, known or not, built in one walk. tags[]
+ * lists them in chain order; tdx_tlv_lookup() finds the first valid tag with
+ * a given id in constant time. Offsets are of the payload, lengths in bytes.
+ */
+#define TDX_TLV_INDEX_MAX	32
+#define TDX_TLV_INDEX_SLOTS	64	/* power of two, > TDX_TLV_INDEX_MAX */
+
+struct tdx_tlv_entry {
+	uint16_t id;
+	uint16_t flags;
+	uint16_t offset;
+	uint16_t len;
+};
+
+struct tdx_tlv_index {
+	unsigned int count;
+	struct tdx_tlv_entry tags[TDX_TLV_INDEX_MAX];
+	uint8_t slot[TDX_TLV_INDEX_SLOTS];	/* tags[] index + 1, 0 if free */
+};
+
+/*
+ * Index a block of `size` bytes. Returns -EINVAL for an invalid header and
+ * -E2BIG, with the first TDX_TLV_INDEX_MAX tags indexed, for longer chains.
+ */
+int tdx_tlv_index_build(const uint8_t *config_block, size_t size,
+	struct tdx_tlv_index *index);
+const struct tdx_tlv_entry *tdx_tlv_lookup(const struct tdx_tlv_index *index,
+	uint16_t id);
+
+/* Append a tag and its payload at *offset, advancing it */
+int tdx_write_tag(uint8_t *config_block, int *offset, int tag_id,
+		  const uint8_t *tag_data, size_t tag_data_size);
+
+#define TDX_CFG_BLOCK_MIN_SIZE	32
+
+/*
+ * Build a complete module or carrier config block of `size` bytes from data,
+ * -EINVAL if size is below TDX_CFG_BLOCK_MIN_SIZE. The module MAC is derived
+ * from data->serial, with the result of tdx_get_mac_from_serial() returned.
+ */
+int tdx_encode_cfg_block(uint8_t *config_block, size_t size,
+	struct tdx_data *data);
+int tdx_encode_cfg_block_carrier(uint8_t *config_block, size_t size,
+	struct tdx_data *data);
+
+/* Batch decoding kernels, see tdx_decode_cfg_blocks() */
+enum {
+	TDX_TLV_SCALAR,
+	TDX_TLV_SSE2,
+	TDX_TLV_AVX2,
+	TDX_TLV_NEON,
+	TDX_TLV_IMPL_COUNT,
+};
+
+extern const char * const tdx_tlv_impl_name[TDX_TLV_IMPL_COUNT];
+
+int tdx_tlv_best_impl(void);
+int tdx_tlv_impl_supported(int impl);
+
+/*
+ * Decode `count` complete blocks of `stride` bytes each, all of type `type`,
+ * into data[] with ret[] set the way tdx_parse_cfg_block() would return it.
+ * Returns the number of valid blocks.
+ */
+size_t tdx_decode_cfg_blocks(int impl, const uint8_t *blocks, size_t stride,
+	size_t count, uint32_t type, struct tdx_data *data, int *ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TDX_CFG_BLOCK_H */
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Static tracepoints (USDT, provider "tdx_cfgblock") for bpftrace and perf,
+ * see tdx-cfgblock.bt. Built against <sys/sdt.h> (systemtap-sdt-dev), every
+ * tracepoint is a single nop plus an ELF note until a tracer attaches to it;
+ * without that header they compile to nothing. Define TDX_NO_TRACE to leave
+ * them out regardless.
+ *
+ * Probes that need extra work to compute their arguments, like a duration,
+ * have a semaphore, which the tracer raises while attached: define
+ * TDX_TRACE_SEMAPHORES before including this, give every probe of the file a
+ * TDX_TRACE_SEMAPHORE() and test TDX_TRACE_ENABLED() before doing the work.
+ */
+
+#ifndef _TDX_TRACE_H
+#define _TDX_TRACE_H
+
+#if !defined(TDX_NO_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define TDX_HAVE_SDT
+#endif
+#endif
+
+#ifdef TDX_HAVE_SDT
+
+#ifdef TDX_TRACE_SEMAPHORES
+#define _SDT_HAS_SEMAPHORES 1
+#endif
+#include <sys/sdt.h>
+
+#define TDX_TRACE3(name, a1, a2, a3) \
+	STAP_PROBE3(tdx_cfgblock, name, a1, a2, a3)
+#define TDX_TRACE5(name, a1, a2, a3, a4, a5) \
+	STAP_PROBE5(tdx_cfgblock, name, a1, a2, a3, a4, a5)
+
+#define TDX_TRACE_SEMAPHORE(name) \
+	__extension__ unsigned short tdx_cfgblock_##name##_semaphore \
+	__attribute__((unused)) __attribute__((section(".probes")))
+#define TDX_TRACE_ENABLED(name) \
+	__builtin_expect(tdx_cfgblock_##name##_semaphore != 0, 0)
+
+#else
+
+#define TDX_TRACE3(name, a1, a2, a3) \
+	do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define TDX_TRACE5(name, a1, a2, a3, a4, a5) \
+	do { \
+		(void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); \
+	} while (0)
+
+#define TDX_TRACE_SEMAPHORE(name) \
+	extern unsigned short tdx_cfgblock_##name##_semaphore
+#define TDX_TRACE_ENABLED(name) 0
+
+#endif
+
+#endif /* _TDX_TRACE_H */